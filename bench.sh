@@ -0,0 +1,29 @@
+#! /bin/bash
+
+# Builds and runs the benchmarks in bench/, or only the ones named.
+# With REVISION set to a git revision they're built against that
+# revision's library instead of the working tree's, for comparing
+# before and after a change, e.g. REVISION=HEAD~ ./bench.sh frag
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+for file in my_pthread.c my_pthread_t.h mylib.c mylib.h; do
+    if [ -n "$REVISION" ]; then
+        git show "$REVISION:$file" > "$dir/$file" || exit 1
+    else
+        cp "$file" "$dir/" || exit 1
+    fi
+done
+
+names="$*"
+if [ -z "$names" ]; then
+    names=$(basename -s .c bench/*.c)
+fi
+
+status=0
+for name in $names; do
+    gcc -O2 -I"$dir" -o "$dir/$name" "bench/$name.c" "$dir/mylib.c" "$dir/my_pthread.c" &&
+    (cd "$dir" && "./$name") || status=1
+done
+exit $status
@@ -0,0 +1,65 @@
+#include "my_pthread_t.h"
+#include <sys/wait.h>
+#include <time.h>
+
+// Fault latency with faults caught by the SIGSEGV handler and by
+// userfaultfd. NUM_THREADS threads take turns writing NUM_PAGES pages
+// at the same page numbers, so every write after a switch faults to
+// swap its page into place. Each backend runs in its own process
+// since the memory manager reads MYLIB_FAULT_MODE when it starts.
+
+#define NUM_THREADS 4
+#define NUM_PAGES 100
+#define PAGE_SIZE 4096
+#define NUM_ROUNDS 200
+
+double getNanoseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e9) + time.tv_nsec;
+}
+
+void * writer(void * id) {
+    char * pages = malloc(NUM_PAGES * PAGE_SIZE);
+    if (!pages) { return (void *) 1; }
+    int round, i;
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        for (i = 0; i < NUM_PAGES; i++) { pages[i * PAGE_SIZE] = (char) ((long) id + round); }
+        my_pthread_yield();
+    }
+    free(pages);
+    return NULL;
+}
+
+// Returns 0 if the run's threads got their memory, else 1
+int run(char * faultMode) {
+    int status;
+    fflush(stdout);
+    if (fork()) {
+        wait(&status);
+        return !WIFEXITED(status) || WEXITSTATUS(status);
+    }
+    if (faultMode) { setenv("MYLIB_FAULT_MODE", faultMode, 1); }
+    pthread_t threads[NUM_THREADS];
+    void * ret;
+    long failed = 0, i;
+    double start = getNanoseconds();
+    for (i = 0; i < NUM_THREADS; i++) { pthread_create(&threads[i], NULL, writer, (void *) i); }
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], &ret);
+        failed += (long) ret;
+    }
+    double total = getNanoseconds() - start;
+    struct memoryStats stats;
+    getMemoryStats(&stats);
+    printf("faults %s: %s, %lu faults, resolved in %.0f ns on average and %lu ns at most, %.0f ns of run time per fault\n",
+           faultMode ? faultMode : "signal", failed ? "FAILED" : "ok", stats.faults,
+           (double) stats.faultNanoseconds / stats.faults, stats.maxFaultNanoseconds, total / stats.faults);
+    exit(failed != 0);
+}
+
+int main() {
+    int failed = run(NULL);
+    failed |= run("userfaultfd");
+    return failed;
+}
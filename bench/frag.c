@@ -0,0 +1,69 @@
+#include "my_pthread_t.h"
+#include <time.h>
+
+// Fragmentation of the library's partition under random allocations
+// and frees, and how long each operation takes. Declares the
+// allocator itself so it also builds against older revisions.
+
+#define NUM_SLOTS 20000
+#define NUM_OPS 2000000
+
+void * myallocate(size_t size, char * fileName, int lineNumber, int request);
+void mydeallocate(void * ptr, char * fileName, int lineNumber, int request);
+
+void * slots[NUM_SLOTS];
+size_t sizes[NUM_SLOTS];
+unsigned long long seed = 88172645463325252ULL;
+
+// xorshift so every run makes the same requests
+unsigned long long nextRandom() {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+int main() {
+    struct timespec start, end;
+    long i, fails = 0, liveBytes = 0;
+
+    // Frees a random slot's block or fills it with mostly small
+    // blocks and every eighth one up to 2 KB
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < NUM_OPS; i++) {
+        long slot = nextRandom() % NUM_SLOTS;
+        if (slots[slot]) {
+            mydeallocate(slots[slot], __FILE__, __LINE__, LIBRARYREQ);
+            slots[slot] = NULL;
+            liveBytes -= sizes[slot];
+            continue;
+        }
+        size_t size = (nextRandom() % 8 == 0) ? 16 + nextRandom() % 2000 : 8 + nextRandom() % 120;
+        slots[slot] = myallocate(size, __FILE__, __LINE__, LIBRARYREQ);
+        if (slots[slot] == NULL) {
+            fails++;
+            continue;
+        }
+        sizes[slot] = size;
+        liveBytes += size;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Binary search for the largest block that can still be allocated
+    size_t low = 0, high = 8 << 20;
+    while (low + 1 < high) {
+        size_t size = (low + high) / 2;
+        void * ptr = myallocate(size, __FILE__, __LINE__, LIBRARYREQ);
+        if (ptr) {
+            mydeallocate(ptr, __FILE__, __LINE__, LIBRARYREQ);
+            low = size;
+        } else {
+            high = size;
+        }
+    }
+
+    double nanoseconds = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("frag: %.1f ns/op, %ld failed, %ld bytes live, largest free block %zu bytes\n",
+           nanoseconds / NUM_OPS, fails, liveBytes, low);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "my_pthread_t.h"
+#include <sys/wait.h>
+#include <time.h>
+
+// Time for NUM_OPS mallocs and frees of 32 to 131 bytes in each of
+// two threads holding NUM_KEPT blocks, with the heap profiler off,
+// sampling every SAMPLE_INTERVAL bytes on average, and recording
+// every allocation. Each runs in its own process since the memory
+// manager reads MYLIB_HEAP_PROFILE when it starts, and the profile
+// written at exit is thrown away.
+
+#define NUM_THREADS 2
+#define NUM_KEPT 2000
+#define NUM_OPS 200000
+#define SAMPLE_INTERVAL "524288"
+
+double getMicroseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e6) + (time.tv_nsec / 1e3);
+}
+
+void * churner(void * arg) {
+    char * kept[NUM_KEPT];
+    int i;
+    for (i = 0; i < NUM_KEPT; i++) { kept[i] = malloc(64); }
+    for (i = 0; i < NUM_OPS; i++) {
+        char * block = malloc(32 + (i % 100));
+        if (!block) { return (void *) 1; }
+        block[0] = 1;
+        free(block);
+    }
+    for (i = 0; i < NUM_KEPT; i++) { free(kept[i]); }
+    return NULL;
+}
+
+// Returns 0 if the run's allocations succeeded, else 1
+int run(char * name, char * sampleInterval) {
+    int status;
+    fflush(stdout);
+    if (fork()) {
+        wait(&status);
+        return !WIFEXITED(status) || WEXITSTATUS(status);
+    }
+    if (sampleInterval) { setenv("MYLIB_HEAP_PROFILE", sampleInterval, 1); }
+    freopen("/dev/null", "w", stderr);
+    pthread_t threads[NUM_THREADS];
+    void * ret;
+    long failed = 0;
+    int i;
+    double start = getMicroseconds();
+    for (i = 0; i < NUM_THREADS; i++) { pthread_create(&threads[i], NULL, churner, NULL); }
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], &ret);
+        failed += (long) ret;
+    }
+    double total = getMicroseconds() - start;
+    printf("heapprof %s: %s, %.0f ms for %d mallocs and frees\n", name, failed ? "FAILED" : "ok", total / 1000,
+           NUM_THREADS * (NUM_OPS + NUM_KEPT));
+    exit(failed != 0);
+}
+
+int main() {
+    int failed = run("off", NULL);
+    failed |= run("sampling", SAMPLE_INTERVAL);
+    failed |= run("every allocation", "0");
+    return failed;
+}
@@ -0,0 +1,160 @@
+#include "my_pthread_t.h"
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Threads waiting on file descriptors. A pair of threads bouncing a
+// byte through two pipes next to a thread that keeps counting, clients
+// of a loopback echo server with a thread per connection, and the CPU
+// used while the only thread waits for another process to write.
+
+#define NUM_PINGS 2000
+#define NUM_CLIENTS 16
+#define NUM_MESSAGES 500
+#define IDLE_WAIT 200000
+
+int pings[2];
+int pongs[2];
+struct sockaddr_in address;
+volatile int stop = 0;
+volatile long counted = 0;
+int failed = 0;
+
+double getMicroseconds() {
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    return (time.tv_sec * 1e6) + time.tv_usec;
+}
+
+double getCpuMicroseconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return ((usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6) + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+void * pinger(void * arg) {
+    char byte = 0;
+    int i;
+    for (i = 0; i < NUM_PINGS; i++) {
+        if (my_write(pings[1], &byte, 1) != 1 || my_read(pongs[0], &byte, 1) != 1) { failed = 1; }
+    }
+    return NULL;
+}
+
+void * ponger(void * arg) {
+    char byte;
+    int i;
+    for (i = 0; i < NUM_PINGS; i++) {
+        if (my_read(pings[0], &byte, 1) != 1 || my_write(pongs[1], &byte, 1) != 1) { failed = 1; }
+    }
+    return NULL;
+}
+
+void * counter(void * arg) {
+    while (!stop) { counted++; }
+    return NULL;
+}
+
+// Echoes everything read from the connection until the client closes it
+void * connection(void * fd) {
+    char buf[64];
+    ssize_t numRead;
+    while ((numRead = my_read((long) fd, buf, sizeof(buf))) > 0) {
+        if (my_write((long) fd, buf, numRead) != numRead) { failed = 1; }
+    }
+    close((long) fd);
+    return NULL;
+}
+
+void * server(void * listener) {
+    pthread_t threads[NUM_CLIENTS];
+    int i;
+    for (i = 0; i < NUM_CLIENTS; i++) {
+        long fd = my_accept((long) listener, NULL, NULL);
+        if (fd < 0) {
+            failed = 1;
+            return NULL;
+        }
+        pthread_create(&threads[i], NULL, connection, (void *) fd);
+    }
+    for (i = 0; i < NUM_CLIENTS; i++) { pthread_join(threads[i], NULL); }
+    return NULL;
+}
+
+void * client(void * id) {
+    char sent[32], received[32];
+    int i, fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (my_connect(fd, (struct sockaddr *) &address, sizeof(address)) == -1) {
+        failed = 1;
+        return NULL;
+    }
+    for (i = 0; i < NUM_MESSAGES; i++) {
+        int length = sprintf(sent, "%ld:%d", (long) id, i);
+        int numReceived = 0;
+        my_write(fd, sent, length);
+        while (numReceived < length) {
+            ssize_t ret = my_read(fd, received + numReceived, length - numReceived);
+            if (ret <= 0) {
+                failed = 1;
+                return NULL;
+            }
+            numReceived += ret;
+        }
+        if (memcmp(sent, received, length) != 0) { failed = 1; }
+    }
+    close(fd);
+    return NULL;
+}
+
+int main() {
+    pthread_t pingThread, pongThread, counterThread, serverThread, clients[NUM_CLIENTS];
+    long i;
+
+    pipe(pings);
+    pipe(pongs);
+    double start = getMicroseconds();
+    pthread_create(&counterThread, NULL, counter, NULL);
+    pthread_create(&pingThread, NULL, pinger, NULL);
+    pthread_create(&pongThread, NULL, ponger, NULL);
+    pthread_join(pingThread, NULL);
+    pthread_join(pongThread, NULL);
+    stop = 1;
+    pthread_join(counterThread, NULL);
+    printf("io: pipe ping-pong %.1f us per round trip, counter reached %ld meanwhile\n",
+           (getMicroseconds() - start) / NUM_PINGS, counted);
+
+    socklen_t length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    long listener = socket(AF_INET, SOCK_STREAM, 0);
+    bind(listener, (struct sockaddr *) &address, sizeof(address));
+    getsockname(listener, (struct sockaddr *) &address, &length);
+    listen(listener, NUM_CLIENTS);
+    start = getMicroseconds();
+    pthread_create(&serverThread, NULL, server, (void *) listener);
+    for (i = 0; i < NUM_CLIENTS; i++) { pthread_create(&clients[i], NULL, client, (void *) i); }
+    for (i = 0; i < NUM_CLIENTS; i++) { pthread_join(clients[i], NULL); }
+    pthread_join(serverThread, NULL);
+    close(listener);
+    printf("io: %d echo clients x %d messages %.0f ms\n", NUM_CLIENTS, NUM_MESSAGES, (getMicroseconds() - start) / 1000);
+
+    // The child writes once it's done sleeping
+    int idle[2];
+    char byte;
+    pipe(idle);
+    if (fork() == 0) {
+        usleep(IDLE_WAIT);
+        write(idle[1], "x", 1);
+        _exit(0);
+    }
+    start = getMicroseconds();
+    double cpuStart = getCpuMicroseconds();
+    if (my_read(idle[0], &byte, 1) != 1) { failed = 1; }
+    printf("io: idle read waited %.0f ms using %.1f ms of CPU\n",
+           (getMicroseconds() - start) / 1000, (getCpuMicroseconds() - cpuStart) / 1000);
+    wait(NULL);
+    return failed;
+}
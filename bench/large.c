@@ -0,0 +1,52 @@
+#include "my_pthread_t.h"
+#include <string.h>
+#include <time.h>
+
+// Time to allocate and to free a LARGE_SIZE block in a thread that
+// already has small blocks, averaged over NUM_ROUNDS rounds, and that
+// the block is usable. Uses only malloc and free so it builds against
+// older revisions.
+
+#define LARGE_SIZE (2 * 1024 * 1024)
+#define NUM_SMALL 50
+#define NUM_ROUNDS 20
+
+double mallocTime = 0;
+double freeTime = 0;
+
+double getMicroseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e6) + (time.tv_nsec / 1e3);
+}
+
+void * worker(void * arg) {
+    char * small[NUM_SMALL];
+    int i;
+    for (i = 0; i < NUM_SMALL; i++) { small[i] = malloc(100 + (i * 10)); }
+    for (i = 0; i < NUM_ROUNDS; i++) {
+        double start = getMicroseconds();
+        char * large = malloc(LARGE_SIZE);
+        mallocTime += getMicroseconds() - start;
+        if (!large) { return (void *) 1; }
+        large[0] = large[LARGE_SIZE - 1] = 1;
+        start = getMicroseconds();
+        free(large);
+        freeTime += getMicroseconds() - start;
+    }
+    for (i = 0; i < NUM_SMALL; i++) { free(small[i]); }
+    return NULL;
+}
+
+int main() {
+    pthread_t thread;
+    void * ret;
+    pthread_create(&thread, NULL, worker, NULL);
+    pthread_join(thread, &ret);
+    if (ret) {
+        printf("large: malloc failed\n");
+        return 1;
+    }
+    printf("large: %d KB malloc %.0f us, free %.0f us\n", LARGE_SIZE / 1024, mallocTime / NUM_ROUNDS, freeTime / NUM_ROUNDS);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include "my_pthread_t.h"
+#include <time.h>
+
+// Time per operation for NUM_THREADS threads each replacing random
+// blocks out of NUM_LIVE live shared blocks of 8 to 207 bytes with
+// new ones NUM_OPS times. Uses only shalloc and free so it builds
+// against older revisions.
+
+#define NUM_THREADS 4
+#define NUM_LIVE 64
+#define NUM_OPS 400000
+
+int failed = 0;
+
+double getNanoseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e9) + time.tv_nsec;
+}
+
+void * churner(void * id) {
+    char * live[NUM_LIVE] = { NULL };
+    unsigned int seed = ((long) id * 7919) + 1;
+    int i;
+    for (i = 0; i < NUM_OPS; i++) {
+        seed = (seed * 1103515245) + 12345;
+        int slot = (seed >> 8) % NUM_LIVE;
+        if (live[slot]) {
+            if (live[slot][0] != (char) slot) { failed = 1; }
+            free(live[slot]);
+        }
+        size_t size = 8 + ((seed >> 16) % 200);
+        live[slot] = shalloc(size);
+        if (!live[slot]) {
+            failed = 1;
+            return NULL;
+        }
+        live[slot][0] = (char) slot;
+        live[slot][size - 1] = 1;
+    }
+    for (i = 0; i < NUM_LIVE; i++) { free(live[i]); }
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[NUM_THREADS];
+    long i;
+    double start = getNanoseconds();
+    for (i = 0; i < NUM_THREADS; i++) { pthread_create(&threads[i], NULL, churner, (void *) i); }
+    for (i = 0; i < NUM_THREADS; i++) { pthread_join(threads[i], NULL); }
+    double total = getNanoseconds() - start;
+    printf("magazines: %s, %.0f ns per shalloc and free\n", failed ? "FAILED" : "ok", total / (NUM_THREADS * NUM_OPS));
+    return failed;
+}
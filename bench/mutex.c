@@ -0,0 +1,53 @@
+#include "my_pthread_t.h"
+#include <time.h>
+
+// Threads locking and unlocking one mutex around a short critical
+// section, timed against one thread doing all of the same work.
+// Builds against revisions from before the mutex counters.
+
+#define NUM_THREADS 4
+#define NUM_LOCKS 2000000
+#define CRITICAL_LOOPS 20
+
+pthread_mutex_t mutex;
+volatile long counter = 0;
+
+double getMilliseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e3) + (time.tv_nsec / 1e6);
+}
+
+void * worker(void * numLocks) {
+    long i;
+    volatile int loops;
+    for (i = 0; i < (long) numLocks; i++) {
+        pthread_mutex_lock(&mutex);
+        counter++;
+        for (loops = 0; loops < CRITICAL_LOOPS; loops++);
+        pthread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+// Returns how long <numThreads> threads took to lock the
+// mutex NUM_LOCKS times each, or -1 if a lock was lost
+double run(int numThreads, long numLocks) {
+    pthread_t threads[NUM_THREADS];
+    int i;
+    counter = 0;
+    double start = getMilliseconds();
+    for (i = 0; i < numThreads; i++) { pthread_create(&threads[i], NULL, worker, (void *) numLocks); }
+    for (i = 0; i < numThreads; i++) { pthread_join(threads[i], NULL); }
+    double milliseconds = getMilliseconds() - start;
+    return (counter == numThreads * numLocks) ? milliseconds : -1;
+}
+
+int main() {
+    pthread_mutex_init(&mutex, NULL);
+    double contended = run(NUM_THREADS, NUM_LOCKS);
+    double alone = run(1, (long) NUM_THREADS * NUM_LOCKS);
+    printf("mutex: %d threads x %d locks %.1f ms, 1 thread alone %.1f ms\n",
+           NUM_THREADS, NUM_LOCKS, contended, alone);
+    return contended < 0 || alone < 0;
+}
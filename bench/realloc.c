@@ -0,0 +1,66 @@
+#include "my_pthread_t.h"
+#include <string.h>
+#include <time.h>
+
+// Time to grow a block from MIN_SIZE to MAX_SIZE by doubling it with
+// realloc, against doing the same with malloc, memcpy and free,
+// averaged over NUM_ROUNDS rounds in a thread.
+
+#define MIN_SIZE 64
+#define MAX_SIZE (1024 * 1024)
+#define NUM_ROUNDS 20
+
+double getMicroseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e6) + (time.tv_nsec / 1e3);
+}
+
+// Returns the microseconds it took, or -1 if an allocation failed
+double grow(int useRealloc) {
+    double start = getMicroseconds();
+    char * block = malloc(MIN_SIZE);
+    if (!block) { return -1; }
+    memset(block, 1, MIN_SIZE);
+    size_t size;
+    for (size = MIN_SIZE * 2; size <= MAX_SIZE; size *= 2) {
+        char * grown;
+        if (useRealloc) { grown = realloc(block, size); }
+        else {
+            grown = malloc(size);
+            if (grown) {
+                memcpy(grown, block, size / 2);
+                free(block);
+            }
+        }
+        if (!grown) { return -1; }
+        block = grown;
+        memset(block + (size / 2), 1, size / 2);
+    }
+    free(block);
+    return getMicroseconds() - start;
+}
+
+void * worker(void * arg) {
+    double times[2] = { 0, 0 };
+    int round, useRealloc;
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        for (useRealloc = 0; useRealloc < 2; useRealloc++) {
+            double time = grow(useRealloc);
+            if (time < 0) { return (void *) 1; }
+            times[useRealloc] += time;
+        }
+    }
+    printf("realloc: growing to %d KB took %.0f us with realloc and %.0f us with malloc and memcpy\n",
+           MAX_SIZE / 1024, times[1] / NUM_ROUNDS, times[0] / NUM_ROUNDS);
+    return NULL;
+}
+
+int main() {
+    pthread_t thread;
+    void * ret;
+    pthread_create(&thread, NULL, worker, NULL);
+    pthread_join(thread, &ret);
+    if (ret) { printf("realloc: allocation failed\n"); }
+    return ret != NULL;
+}
@@ -0,0 +1,51 @@
+#include "my_pthread_t.h"
+#include <string.h>
+#include <time.h>
+
+// Time for batches of threads that each allocate, fill and free a big
+// block NUM_ALLOCATIONS times while holding a small one, then exit.
+// Uses only malloc and free so it builds against older revisions.
+
+#define NUM_BATCHES 200
+#define NUM_THREADS 4
+#define NUM_ALLOCATIONS 20
+#define BIG_SIZE (200 * 4096)
+
+double getMicroseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e6) + (time.tv_nsec / 1e3);
+}
+
+void * worker(void * arg) {
+    int i;
+    for (i = 0; i < NUM_ALLOCATIONS; i++) {
+        char * big = malloc(BIG_SIZE);
+        if (!big) { return (void *) 1; }
+        memset(big, 1, BIG_SIZE);
+        char * small = malloc(100);
+        if (!small) { return (void *) 1; }
+        small[0] = 1;
+        free(big);
+        free(small);
+    }
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[NUM_THREADS];
+    void * ret;
+    long failed = 0;
+    int batch, i;
+    double start = getMicroseconds();
+    for (batch = 0; batch < NUM_BATCHES; batch++) {
+        for (i = 0; i < NUM_THREADS; i++) { pthread_create(&threads[i], NULL, worker, NULL); }
+        for (i = 0; i < NUM_THREADS; i++) {
+            pthread_join(threads[i], &ret);
+            failed += (long) ret;
+        }
+    }
+    double total = getMicroseconds() - start;
+    printf("reclaim: %s, %d threads in %.0f ms\n", failed ? "FAILED" : "ok", NUM_BATCHES * NUM_THREADS, total / 1000);
+    return failed != 0;
+}
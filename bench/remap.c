@@ -0,0 +1,65 @@
+#include "my_pthread_t.h"
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+// Two threads whose pages don't both fit in memory take turns writing
+// every one of their pages, so each write after a switch swaps a page
+// between memory pages. Runs once copying pages and once remapping
+// them, each in its own process since the memory manager reads
+// MYLIB_REMAP_PAGE_SIZE when it starts.
+
+#define NUM_PAGES 300
+#define PAGE_SIZE 4096
+#define NUM_ROUNDS 50
+
+double getMicroseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e6) + (time.tv_nsec / 1e3);
+}
+
+void * writer(void * id) {
+    char * pages = malloc(NUM_PAGES * PAGE_SIZE);
+    if (!pages) { return (void *) 1; }
+    int round, i;
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        for (i = 0; i < NUM_PAGES; i++) { pages[i * PAGE_SIZE] = (char) ((long) id + round); }
+        my_pthread_yield();
+        for (i = 0; i < NUM_PAGES; i++) {
+            if (pages[i * PAGE_SIZE] != (char) ((long) id + round)) { return (void *) 1; }
+        }
+    }
+    free(pages);
+    return NULL;
+}
+
+// Returns 0 if the run's pages kept their contents, else 1
+int run(char * name, char * remapSize) {
+    int status;
+    fflush(stdout);
+    if (fork()) {
+        wait(&status);
+        return !WIFEXITED(status) || WEXITSTATUS(status);
+    }
+    if (remapSize) { setenv("MYLIB_REMAP_PAGE_SIZE", remapSize, 1); }
+    pthread_t threads[2];
+    void * ret;
+    long failed = 0, i;
+    double start = getMicroseconds();
+    for (i = 0; i < 2; i++) { pthread_create(&threads[i], NULL, writer, (void *) i); }
+    for (i = 0; i < 2; i++) {
+        pthread_join(threads[i], &ret);
+        failed += (long) ret;
+    }
+    double total = getMicroseconds() - start;
+    printf("remap %s: %s, %.2f us per page written after a switch\n", name, failed ? "FAILED" : "ok",
+           total / (2 * NUM_ROUNDS * NUM_PAGES));
+    exit(failed != 0);
+}
+
+int main() {
+    int failed = run("copy", NULL);
+    failed |= run("remap", "0");
+    return failed;
+}
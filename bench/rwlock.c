@@ -0,0 +1,77 @@
+#include "my_pthread_t.h"
+#include <time.h>
+
+// Readers and an occasional writer sharing two counters that
+// must always match, guarded once by a reader-writer lock and
+// once by a mutex
+
+#define NUM_READERS 4
+#define NUM_READS 1000000
+#define NUM_WRITES (NUM_READS / 100)
+#define CRITICAL_LOOPS 50
+
+pthread_rwlock_t rwlock;
+pthread_mutex_t mutex;
+int useMutex = 0;
+volatile long first = 0;
+volatile long second = 0;
+int torn = 0;
+
+double getMilliseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e3) + (time.tv_nsec / 1e6);
+}
+
+void * reader(void * arg) {
+    long i;
+    volatile int loops;
+    for (i = 0; i < NUM_READS; i++) {
+        if (useMutex) { pthread_mutex_lock(&mutex); }
+        else { pthread_rwlock_rdlock(&rwlock); }
+        long value = first;
+        for (loops = 0; loops < CRITICAL_LOOPS; loops++);
+        if (second != value) { torn = 1; }
+        if (useMutex) { pthread_mutex_unlock(&mutex); }
+        else { pthread_rwlock_unlock(&rwlock); }
+    }
+    return NULL;
+}
+
+void * writer(void * arg) {
+    long i;
+    volatile int loops;
+    for (i = 0; i < NUM_WRITES; i++) {
+        if (useMutex) { pthread_mutex_lock(&mutex); }
+        else { pthread_rwlock_wrlock(&rwlock); }
+        first++;
+        for (loops = 0; loops < CRITICAL_LOOPS; loops++);
+        second++;
+        if (useMutex) { pthread_mutex_unlock(&mutex); }
+        else { pthread_rwlock_unlock(&rwlock); }
+    }
+    return NULL;
+}
+
+// Returns how long the readers and the writer took
+double run() {
+    pthread_t threads[NUM_READERS + 1];
+    int i;
+    double start = getMilliseconds();
+    for (i = 0; i < NUM_READERS; i++) { pthread_create(&threads[i], NULL, reader, NULL); }
+    pthread_create(&threads[NUM_READERS], NULL, writer, NULL);
+    for (i = 0; i <= NUM_READERS; i++) { pthread_join(threads[i], NULL); }
+    return getMilliseconds() - start;
+}
+
+int main() {
+    pthread_rwlock_init(&rwlock, NULL);
+    pthread_mutex_init(&mutex, NULL);
+    double rwlockTime = run();
+    useMutex = 1;
+    double mutexTime = run();
+    printf("rwlock: %d readers and a writer %.1f ms, with a mutex %.1f ms\n", NUM_READERS, rwlockTime, mutexTime);
+    printf("rwlock: read contentions %lu/%lu, write contentions %lu/%lu\n",
+           rwlock.readContentions, rwlock.readAcquisitions, rwlock.writeContentions, rwlock.writeAcquisitions);
+    return torn;
+}
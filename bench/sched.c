@@ -0,0 +1,105 @@
+#include "my_pthread_t.h"
+#include <time.h>
+
+// Round trips of a semaphore ping-pong pair competing with CPU hogs,
+// and the scheduling latencies the scheduler saw meanwhile. Then how
+// two spinning threads at nice 0 and nice 5 split the CPU. Run with
+// MY_PTHREAD_SCHEDULER=fair to compare the fair scheduler with MLFQ.
+
+#define NUM_HOGS 3
+#define NUM_ROUNDS 400
+#define PING_LOOPS 200000
+#define PONG_LOOPS 20000
+#define NICE_MILLISECONDS 1000
+#define LOW_NICE 5
+
+sem_t ping;
+sem_t pong;
+double roundTrips[NUM_ROUNDS];
+volatile int stop = 0;
+volatile long work[2];
+
+double getMicroseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e6) + (time.tv_nsec / 1e3);
+}
+
+void * hog(void * arg) {
+    volatile long loops = 0;
+    while (!stop) { loops++; }
+    return NULL;
+}
+
+void * pinger(void * arg) {
+    int i;
+    volatile long loops;
+    for (i = 0; i < NUM_ROUNDS; i++) {
+        double start = getMicroseconds();
+        sem_post(&ping);
+        sem_wait(&pong);
+        roundTrips[i] = getMicroseconds() - start;
+        for (loops = 0; loops < PING_LOOPS; loops++);
+    }
+    return NULL;
+}
+
+void * ponger(void * arg) {
+    int i;
+    volatile long loops;
+    for (i = 0; i < NUM_ROUNDS; i++) {
+        sem_wait(&ping);
+        for (loops = 0; loops < PONG_LOOPS; loops++);
+        sem_post(&pong);
+    }
+    return NULL;
+}
+
+void * counter(void * id) {
+    while (!stop) { work[(long) id]++; }
+    return NULL;
+}
+
+int compareDoubles(const void * a, const void * b) {
+    double difference = *(double *) a - *(double *) b;
+    return (difference > 0) - (difference < 0);
+}
+
+int main() {
+    pthread_t hogs[NUM_HOGS], pingThread, pongThread, counters[2];
+    int i;
+    sem_init(&ping, 0, 0);
+    sem_init(&pong, 0, 0);
+
+    double start = getMicroseconds();
+    for (i = 0; i < NUM_HOGS; i++) { pthread_create(&hogs[i], NULL, hog, NULL); }
+    pthread_create(&pingThread, NULL, pinger, NULL);
+    pthread_create(&pongThread, NULL, ponger, NULL);
+    pthread_join(pingThread, NULL);
+    pthread_join(pongThread, NULL);
+    stop = 1;
+    for (i = 0; i < NUM_HOGS; i++) { pthread_join(hogs[i], NULL); }
+    double total = getMicroseconds() - start;
+
+    struct schedulerStats stats;
+    getSchedulerStats(&stats);
+    qsort(roundTrips, NUM_ROUNDS, sizeof(double), compareDoubles);
+    printf("sched %s: round trip p50 %.0f p99 %.0f max %.0f us, total %.0f ms\n", stats.fair ? "fair" : "mlfq",
+           roundTrips[NUM_ROUNDS / 2], roundTrips[(NUM_ROUNDS * 99) / 100], roundTrips[NUM_ROUNDS - 1], total / 1000);
+    printf("sched %s: latency p50 %lu p99 %lu max %lu us over %lu switches\n", stats.fair ? "fair" : "mlfq",
+           stats.p50Latency, stats.p99Latency, stats.maxLatency, stats.switches);
+
+    // The main thread yields so it doesn't take a share of the CPU
+    stop = 0;
+    pthread_create(&counters[0], NULL, counter, (void *) 0);
+    pthread_create(&counters[1], NULL, counter, (void *) 1);
+    my_pthread_setnice(counters[1], LOW_NICE);
+    start = getMicroseconds();
+    while (getMicroseconds() - start < NICE_MILLISECONDS * 1000) { my_pthread_yield(); }
+    stop = 1;
+    pthread_join(counters[0], NULL);
+    pthread_join(counters[1], NULL);
+    printf("sched %s: nice 0 did %.2f times the work of nice %d\n", stats.fair ? "fair" : "mlfq",
+           (double) work[0] / work[1], LOW_NICE);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "my_pthread_t.h"
+#include <string.h>
+#include <time.h>
+
+// Time for NUM_THREADS threads to push NUM_NODES shared nodes of
+// varied sizes each onto a list and for main to free them, then
+// to allocate one BIG_SIZE shared block. Shared memory used to be
+// a few pages, so older revisions run out.
+
+#define NUM_THREADS 4
+#define NUM_NODES 2500
+#define BIG_SIZE (512 * 1024)
+
+struct node {
+    struct node * next;
+    long value;
+    char pad[40];
+};
+
+struct node * head = NULL;
+my_pthread_mutex_t lock;
+
+double getMicroseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e6) + (time.tv_nsec / 1e3);
+}
+
+void * producer(void * id) {
+    long i;
+    for (i = 0; i < NUM_NODES; i++) {
+        struct node * node = shalloc(sizeof(struct node) + ((i % 7) * 24));
+        if (!node) { return (void *) 1; }
+        node->value = ((long) id * NUM_NODES) + i;
+        my_pthread_mutex_lock(&lock);
+        node->next = head;
+        head = node;
+        my_pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[NUM_THREADS];
+    void * ret;
+    long failed = 0, count = 0, i;
+    my_pthread_mutex_init(&lock, NULL);
+    double start = getMicroseconds();
+    for (i = 0; i < NUM_THREADS; i++) { pthread_create(&threads[i], NULL, producer, (void *) i); }
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], &ret);
+        failed += (long) ret;
+    }
+    while (head) {
+        struct node * node = head;
+        head = node->next;
+        free(node);
+        count++;
+    }
+    char * big = shalloc(BIG_SIZE);
+    if (big) {
+        memset(big, 1, BIG_SIZE);
+        free(big);
+    } else { failed++; }
+    double total = getMicroseconds() - start;
+    printf("shared: %s, %ld nodes and a %d KB block in %.2f ms\n", failed ? "FAILED" : "ok", count, BIG_SIZE / 1024, total / 1000);
+    return failed != 0;
+}
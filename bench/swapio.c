@@ -0,0 +1,163 @@
+#include "my_pthread_t.h"
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+// Swapping under two workloads, with the memory manager's counters.
+// In sleepers, NUM_SLEEPERS threads fill their pages and block while
+// NUM_ACTIVE threads keep cycling through theirs. In round robin,
+// NUM_WORKERS threads take turns walking pages that don't all fit in
+// memory. Pages are filled with one byte each, which compresses, or
+// with random bytes, which doesn't. Every run is in its own process,
+// reading and writing swapFile and then mapping it, since the memory
+// manager reads MYLIB_SWAP_MODE when it starts.
+
+#define PAGE_SIZE 4096
+#define NUM_SLEEPERS 6
+#define NUM_ACTIVE 2
+#define NUM_SLEEPER_PAGES 150
+#define NUM_ACTIVE_ROUNDS 200
+#define NUM_WORKERS 8
+#define NUM_WORKER_PAGES 200
+#define NUM_WORKER_ROUNDS 3
+
+my_pthread_mutex_t gate;
+int numSleeping = 0;
+int randomFill;
+
+double getMicroseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e6) + (time.tv_nsec / 1e3);
+}
+
+// Fills or checks numPages pages, returning 1 if a byte was wrong
+int pattern(char * pages, int numPages, long id, int fill) {
+    unsigned long state = id + 1;
+    long i;
+    for (i = 0; i < (long) numPages * PAGE_SIZE; i++) {
+        char expected = (char) (id + (i / PAGE_SIZE));
+        if (randomFill) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            expected = (char) state;
+        }
+        if (fill) { pages[i] = expected; }
+        else if (pages[i] != expected) { return 1; }
+    }
+    return 0;
+}
+
+void * sleeper(void * id) {
+    char * pages = malloc(NUM_SLEEPER_PAGES * PAGE_SIZE);
+    if (!pages) { return (void *) 1; }
+    pattern(pages, NUM_SLEEPER_PAGES, (long) id, 1);
+    numSleeping++;
+    my_pthread_mutex_lock(&gate);
+    my_pthread_mutex_unlock(&gate);
+    long failed = pattern(pages, NUM_SLEEPER_PAGES, (long) id, 0);
+    free(pages);
+    return (void *) failed;
+}
+
+void * active(void * id) {
+    char * pages = malloc(NUM_SLEEPER_PAGES * PAGE_SIZE);
+    if (!pages) { return (void *) 1; }
+    pattern(pages, NUM_SLEEPER_PAGES, (long) id, 1);
+    int round, i;
+    for (round = 0; round < NUM_ACTIVE_ROUNDS; round++) {
+        for (i = 0; i < NUM_SLEEPER_PAGES; i++) { pages[(i * PAGE_SIZE) + 5]++; }
+        my_pthread_yield();
+    }
+    free(pages);
+    return NULL;
+}
+
+void * worker(void * id) {
+    char * pages = malloc(NUM_WORKER_PAGES * PAGE_SIZE);
+    if (!pages) { return (void *) 1; }
+    pattern(pages, NUM_WORKER_PAGES, (long) id, 1);
+    long failed = 0;
+    int round;
+    for (round = 0; round < NUM_WORKER_ROUNDS; round++) {
+        my_pthread_yield();
+        failed |= pattern(pages, NUM_WORKER_PAGES, (long) id, 0);
+    }
+    free(pages);
+    return (void *) failed;
+}
+
+// Timing only the active threads while the sleepers hold their pages
+long runSleepers(double * time) {
+    pthread_t threads[NUM_SLEEPERS + NUM_ACTIVE];
+    void * ret;
+    long failed = 0, i;
+    my_pthread_mutex_init(&gate, NULL);
+
+    // Locking only works once creating a thread has started the library
+    pthread_create(&threads[0], NULL, sleeper, (void *) 0);
+    my_pthread_mutex_lock(&gate);
+    for (i = 1; i < NUM_SLEEPERS; i++) { pthread_create(&threads[i], NULL, sleeper, (void *) i); }
+    while (numSleeping < NUM_SLEEPERS) { my_pthread_yield(); }
+    double start = getMicroseconds();
+    for (; i < NUM_SLEEPERS + NUM_ACTIVE; i++) { pthread_create(&threads[i], NULL, active, (void *) i); }
+    for (i = NUM_SLEEPERS; i < NUM_SLEEPERS + NUM_ACTIVE; i++) {
+        pthread_join(threads[i], &ret);
+        failed += (long) ret;
+    }
+    *time = getMicroseconds() - start;
+    my_pthread_mutex_unlock(&gate);
+    for (i = 0; i < NUM_SLEEPERS; i++) {
+        pthread_join(threads[i], &ret);
+        failed += (long) ret;
+    }
+    return failed;
+}
+
+long runWorkers(double * time) {
+    pthread_t threads[NUM_WORKERS];
+    void * ret;
+    long failed = 0, i;
+    double start = getMicroseconds();
+    for (i = 0; i < NUM_WORKERS; i++) { pthread_create(&threads[i], NULL, worker, (void *) i); }
+    for (i = 0; i < NUM_WORKERS; i++) {
+        pthread_join(threads[i], &ret);
+        failed += (long) ret;
+    }
+    *time = getMicroseconds() - start;
+    return failed;
+}
+
+// Returns 0 if the run's pages kept their contents, else 1
+int run(char * name, long (* workload)(double *), int random, char * swapMode) {
+    int status;
+    fflush(stdout);
+    if (fork()) {
+        wait(&status);
+        return !WIFEXITED(status) || WEXITSTATUS(status);
+    }
+    if (swapMode) { setenv("MYLIB_SWAP_MODE", swapMode, 1); }
+    randomFill = random;
+    double time;
+    long failed = workload(&time);
+    struct memoryStats stats;
+    getMemoryStats(&stats);
+    printf("swapio %s %s %s: %s, %.0f ms\n", name, random ? "random" : "filled", swapMode ? swapMode : "pread",
+           failed ? "FAILED" : "ok", time / 1000);
+    printf("    %lu faults, %lu evictions, %lu swap ins, %lu swap outs in %lu writes, %lu compressed outs, %lu compressed ins\n",
+           stats.faults, stats.evictions, stats.swapIns, stats.swapOuts, stats.swapFileWrites, stats.compressedOuts, stats.compressedIns);
+    exit(failed != 0);
+}
+
+int main() {
+    char * swapModes[2] = { NULL, "mmap" };
+    int failed = 0, mode, random;
+    for (mode = 0; mode < 2; mode++) {
+        for (random = 0; random < 2; random++) {
+            failed |= run("sleepers", runSleepers, random, swapModes[mode]);
+            failed |= run("round robin", runWorkers, random, swapModes[mode]);
+        }
+    }
+    return failed;
+}
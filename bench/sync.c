@@ -0,0 +1,129 @@
+#include "my_pthread_t.h"
+#include <time.h>
+
+// A producer and a consumer passing items through a small buffer
+// next to a thread that keeps the CPU busy. The buffer is passed
+// once with condition variables, once with semaphores and once by
+// unlocking and yielding while the buffer is full or empty, which
+// is what waiting threads did before condition variables.
+
+#define NUM_ITEMS 20000
+#define BUFFER_SIZE 8
+#define BUSY_LOOPS 100000000
+
+int buffer[BUFFER_SIZE];
+int first = 0;
+int count = 0;
+long sum = 0;
+int spin = 0;
+pthread_mutex_t mutex;
+pthread_cond_t notEmpty;
+pthread_cond_t notFull;
+sem_t slots;
+sem_t items;
+
+double getMilliseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e3) + (time.tv_nsec / 1e6);
+}
+
+// Waits with the mutex held until <full> is no longer the buffer's state
+void waitWhile(int full, pthread_cond_t * cond) {
+    while (full ? count == BUFFER_SIZE : count == 0) {
+        if (spin) {
+            pthread_mutex_unlock(&mutex);
+            my_pthread_yield();
+            pthread_mutex_lock(&mutex);
+        } else {
+            pthread_cond_wait(cond, &mutex);
+        }
+    }
+}
+
+void * producer(void * arg) {
+    int i;
+    for (i = 1; i <= NUM_ITEMS; i++) {
+        pthread_mutex_lock(&mutex);
+        waitWhile(1, &notFull);
+        buffer[(first + count++) % BUFFER_SIZE] = i;
+        pthread_cond_signal(&notEmpty);
+        pthread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+void * consumer(void * arg) {
+    int i;
+    for (i = 0; i < NUM_ITEMS; i++) {
+        pthread_mutex_lock(&mutex);
+        waitWhile(0, &notEmpty);
+        sum += buffer[first];
+        first = (first + 1) % BUFFER_SIZE;
+        count--;
+        pthread_cond_signal(&notFull);
+        pthread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+void * semProducer(void * arg) {
+    int i;
+    for (i = 1; i <= NUM_ITEMS; i++) {
+        sem_wait(&slots);
+        buffer[(first + count++) % BUFFER_SIZE] = i;
+        sem_post(&items);
+    }
+    return NULL;
+}
+
+void * semConsumer(void * arg) {
+    int i;
+    for (i = 0; i < NUM_ITEMS; i++) {
+        sem_wait(&items);
+        sum += buffer[first];
+        first = (first + 1) % BUFFER_SIZE;
+        count--;
+        sem_post(&slots);
+    }
+    return NULL;
+}
+
+void * busy(void * arg) {
+    volatile long loops;
+    for (loops = 0; loops < BUSY_LOOPS; loops++);
+    return NULL;
+}
+
+// Runs the producer and consumer next to the busy thread and returns
+// how long they took in milliseconds, or -1 if items were lost
+double run(void *(*produce)(void *), void *(*consume)(void *)) {
+    pthread_t producerThread, consumerThread, busyThread;
+    sum = 0;
+    double start = getMilliseconds();
+    pthread_create(&busyThread, NULL, busy, NULL);
+    pthread_create(&producerThread, NULL, produce, NULL);
+    pthread_create(&consumerThread, NULL, consume, NULL);
+    pthread_join(producerThread, NULL);
+    pthread_join(consumerThread, NULL);
+    double milliseconds = getMilliseconds() - start;
+    pthread_join(busyThread, NULL);
+    return (sum == (long) NUM_ITEMS * (NUM_ITEMS + 1) / 2) ? milliseconds : -1;
+}
+
+int main() {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&notEmpty, NULL);
+    pthread_cond_init(&notFull, NULL);
+    sem_init(&slots, 0, BUFFER_SIZE);
+    sem_init(&items, 0, 0);
+
+    double condition = run(producer, consumer);
+    double semaphore = run(semProducer, semConsumer);
+    spin = 1;
+    double yielding = run(producer, consumer);
+
+    printf("sync: %d items, condition variable %.1f ms, semaphore %.1f ms, yield loop %.1f ms\n",
+           NUM_ITEMS, condition, semaphore, yielding);
+    return condition < 0 || semaphore < 0 || yielding < 0;
+}
@@ -0,0 +1,109 @@
+#include "my_pthread_t.h"
+#include <sys/resource.h>
+
+// Threads waiting for deadlines. First, waiters next to a CPU bound
+// worker, once sleeping in the timer wheel and once polling the time
+// with yield like threads did before. Then idle sleepers with random
+// deadlines and the CPU they cost, and last how late sleepers wake
+// while hogs keep the CPU busy.
+
+#define NUM_WAITERS 50
+#define WAIT_TIME 200000
+#define WORK_LOOPS 100000000
+#define NUM_SLEEPERS 200
+#define MAX_SLEEP 1500000
+#define NUM_HOGS 2
+#define NUM_LOADED_SLEEPERS 10
+
+int usePolling = 0;
+double workTime;
+double maxLateness;
+volatile int stop = 0;
+
+double getMicroseconds() {
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    return (time.tv_sec * 1e6) + time.tv_usec;
+}
+
+double getCpuMicroseconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return ((usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6) + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+void * waiter(void * arg) {
+    if (usePolling) {
+        double end = getMicroseconds() + WAIT_TIME;
+        while (getMicroseconds() < end) { my_pthread_yield(); }
+    } else {
+        my_pthread_sleep(WAIT_TIME);
+    }
+    return NULL;
+}
+
+void * worker(void * arg) {
+    double start = getMicroseconds();
+    volatile long loops;
+    for (loops = 0; loops < WORK_LOOPS; loops++);
+    workTime = getMicroseconds() - start;
+    return NULL;
+}
+
+// Sleeps for <microseconds> and records how late it woke
+void * sleeper(void * microseconds) {
+    double start = getMicroseconds();
+    my_pthread_sleep((long) microseconds);
+    double lateness = getMicroseconds() - start - (long) microseconds;
+    if (lateness > maxLateness) { maxLateness = lateness; }
+    return NULL;
+}
+
+void * hog(void * arg) {
+    volatile long loops = 0;
+    while (!stop) { loops++; }
+    return NULL;
+}
+
+// Returns how long the worker took next to the waiters
+double runWaiters() {
+    pthread_t threads[NUM_WAITERS + 1];
+    int i;
+    for (i = 0; i < NUM_WAITERS; i++) { pthread_create(&threads[i], NULL, waiter, NULL); }
+    pthread_create(&threads[NUM_WAITERS], NULL, worker, NULL);
+    for (i = 0; i <= NUM_WAITERS; i++) { pthread_join(threads[i], NULL); }
+    return workTime;
+}
+
+int main() {
+    pthread_t threads[NUM_SLEEPERS], hogs[NUM_HOGS];
+    int i;
+
+    double sleeping = runWaiters();
+    usePolling = 1;
+    double polling = runWaiters();
+    printf("timers: worker next to %d waiters %.0f ms, %.0f ms when they poll\n",
+           NUM_WAITERS, sleeping / 1000, polling / 1000);
+
+    srand(1);
+    maxLateness = 0;
+    double start = getMicroseconds();
+    double cpuStart = getCpuMicroseconds();
+    for (i = 0; i < NUM_SLEEPERS; i++) {
+        pthread_create(&threads[i], NULL, sleeper, (void *) (long) (1000 + (rand() % MAX_SLEEP)));
+    }
+    for (i = 0; i < NUM_SLEEPERS; i++) { pthread_join(threads[i], NULL); }
+    printf("timers: %d idle sleepers took %.0f ms and %.1f ms of CPU, woke at most %.0f us late\n", NUM_SLEEPERS,
+           (getMicroseconds() - start) / 1000, (getCpuMicroseconds() - cpuStart) / 1000, maxLateness);
+
+    maxLateness = 0;
+    for (i = 0; i < NUM_HOGS; i++) { pthread_create(&hogs[i], NULL, hog, NULL); }
+    for (i = 0; i < NUM_LOADED_SLEEPERS; i++) {
+        pthread_create(&threads[i], NULL, sleeper, (void *) (long) (5000 * (i + 1)));
+    }
+    for (i = 0; i < NUM_LOADED_SLEEPERS; i++) { pthread_join(threads[i], NULL); }
+    stop = 1;
+    for (i = 0; i < NUM_HOGS; i++) { pthread_join(hogs[i], NULL); }
+    printf("timers: sleepers next to %d hogs woke at most %.0f us late\n", NUM_HOGS, maxLateness);
+    return 0;
+}
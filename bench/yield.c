@@ -0,0 +1,47 @@
+#include "my_pthread_t.h"
+#include <string.h>
+#include <time.h>
+
+// Round trips of two threads yielding to each other while each owns
+// NUM_PAGES contiguous pages, so most of a switch is changing which
+// pages are protected.
+
+#define NUM_PAGES 11
+#define PAGE_SIZE 4096
+#define NUM_ROUNDS 20000
+
+double getMicroseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * 1e6) + (time.tv_nsec / 1e3);
+}
+
+void * yielder(void * arg) {
+    char * pages = malloc((NUM_PAGES - 1) * PAGE_SIZE);
+    if (!pages) { return (void *) 1; }
+    memset(pages, 1, (NUM_PAGES - 1) * PAGE_SIZE);
+    int i;
+    for (i = 0; i < NUM_ROUNDS; i++) { my_pthread_yield(); }
+    free(pages);
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[2];
+    void * ret;
+    long failed = 0;
+    int i;
+    double start = getMicroseconds();
+    for (i = 0; i < 2; i++) { pthread_create(&threads[i], NULL, yielder, NULL); }
+    for (i = 0; i < 2; i++) {
+        pthread_join(threads[i], &ret);
+        failed += (long) ret;
+    }
+    double total = getMicroseconds() - start;
+    if (failed) {
+        printf("yield: malloc failed\n");
+        return 1;
+    }
+    printf("yield: %.2f us per round trip with %d pages per thread\n", total / NUM_ROUNDS, NUM_PAGES);
+    return 0;
+}
@@ -9,7 +9,10 @@
 /////////////////////////////////////////
 // All macro times are in microseconds //
 /////////////////////////////////////////
-#define TEMP_SIZE 4096
+// Stack size of threads created without a stack size attribute
+#define STACK_SIZE (64 * 1024)
+// Number of freed stacks kept around for new threads
+#define MAX_POOLED_STACKS 64
 // Number of priority queues
 #define NUM_PRIORITY_LVLS 4
 // Interval time to run scheduler
@@ -18,7 +21,33 @@
 // priority level has a time slice x2 of
 // the priority level above it
 #define BASE_TIME_SLICE INTERRUPT_TIME
-
+// Environment variable selecting the scheduler, set it
+// to "fair" to use the fair scheduler instead of MLFQ
+#define SCHEDULER_ENV "MY_PTHREAD_SCHEDULER"
+// Most a thread's vruntime can be behind the smallest one
+// of the runnable threads when it becomes runnable again
+#define FAIR_WAKEUP_CREDIT INTERRUPT_TIME
+// Range of nice values and the weight of nice 0
+#define MIN_NICE -20
+#define MAX_NICE 19
+#define NICE_0_WEIGHT 1024
+// Length of a tick of the timer wheel
+#define TIMER_RESOLUTION 1000
+// The timer wheel has NUM_WHEEL_LEVELS levels of WHEEL_SIZE slots,
+// each slot of a level spanning all the slots of the level below
+#define NUM_WHEEL_LEVELS 4
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+// Most events taken from epoll at once
+#define MAX_IO_EVENTS 64
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
 #include "my_pthread_t.h"
 
 // Macros for making library malloc calls
@@ -27,22 +56,114 @@
 #define malloc(x) myallocate(x, __FILE__, __LINE__, LIBRARYREQ)
 #define free(x) mydeallocate(x, __FILE__, __LINE__, LIBRARYREQ)
 
+// Casting macros
+#define CHAR_PTR(x) ((char *) (x))
+#define UNSGND_LONG(x) ((unsigned long) (x))
+
+// System page size stored by mylib.c
+extern long pageSize;
+
 // Function from mylib.c for comunication
 void * myallocate(size_t size, char * fileName, int lineNumber, int request);
 void mydeallocate(void * ptr, char * fileName, int lineNumber, int request);
 void protectAllPages(tcb * thread);
 void unprotectAllPages(tcb * thread);
+int initializeThreadMemory(tcb * thread);
+void releaseThreadMemory(tcb * thread);
+void releaseSharedCache(tcb * thread);
+int isResolvingFault(void);
 
 // Checks if library is properly initialized
 char initialized = 0;
-// Exit context
-ucontext_t exitContext;
 // Checks if sheduler should be blocked
 char block = 0;
 // Pointer to the currently running thread's tcb
 tcb * currentTcb = NULL;
+// Freed stacks waiting to be reused
+struct pooledStack * stackPool = NULL;
+// Number of stacks in <stackPool>
+unsigned int numPooledStacks = 0;
 // High priority queue
 struct priorityQueue PQs[NUM_PRIORITY_LVLS];
+// Bit i is set when PQs[i] has at least one thread
+unsigned int readyLevels = 0;
+// Set when the fair scheduler is used instead of MLFQ
+char fairScheduling = 0;
+// Runnable threads of the fair scheduler, <head> is the root of
+// a pairing heap ordered by vruntime and <tail> is unused
+struct queue fairQueue = {NULL, NULL};
+// Smallest vruntime of the runnable threads, never decreases
+unsigned long long minVruntime = 0;
+// Weights of the nice values from MIN_NICE to MAX_NICE, each
+// nice value gets about 1.25 times the CPU of the one above it
+const unsigned int niceWeights[MAX_NICE - MIN_NICE + 1] = {
+	88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+	9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+	1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+	110, 87, 70, 56, 45, 36, 29, 23, 18, 15
+};
+// Scheduler counters
+struct schedulerStats schedStats;
+// Slots of the timer wheel holding threads waiting with a deadline,
+// linked through their timerNext and timerPrevious fields
+tcb * timerWheel[NUM_WHEEL_LEVELS][WHEEL_SIZE];
+// Tick the timer wheel has been advanced to
+unsigned long long wheelTick = 0;
+// Number of threads in the timer wheel
+unsigned int numTimers = 0;
+// Epoll instance for threads waiting on file descriptors
+int epollFd = -1;
+// Waiting threads of each file descriptor, indexed by descriptor
+struct ioWait ** ioWaits = NULL;
+int numIoWaits = 0;
+// Number of threads waiting on file descriptors
+unsigned int numIoWaiters = 0;
+
+#ifdef FAST_SWITCH
+// Saves the callee-saved registers, the floating point control
+// words, and the stack pointer of the running thread in <from> and
+// resumes the thread whose saved stack pointer is <to>. The signal
+// mask is left alone since it's never changed by the scheduler.
+void switchStacks(void ** from, void * to);
+__asm__(
+	".pushsection .text\n"
+	".globl switchStacks\n"
+	".type switchStacks, @function\n"
+	"switchStacks:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size switchStacks, .-switchStacks\n"
+	".popsection\n"
+);
+
+// Default MXCSR (low 4 bytes) and x87 control word
+// (next 2 bytes) loaded by switchStacks for new threads
+#define INITIAL_FP_CONTROL 0x0000037F00001F80UL
+// Number of registers pushed by switchStacks
+#define NUM_SAVED_REGISTERS 6
+
+// Stack pointer saved when the running thread is discarded
+void * discardedStackPointer;
+#endif
 
 // Returns the time between <start> and <end>
 suseconds_t getElapsedTime(struct timeval * start, struct timeval * end) {
@@ -61,111 +182,723 @@ void initializePQs() {
 		PQs[i].queue.head = NULL;
 		PQs[i].queue.tail = NULL;
 	}
+	readyLevels = 0;
+}
+
+// Returns a stack of <size> usable bytes sitting above a guard page,
+// or NULL if it can't be mapped. Reuses a pooled stack of the same
+// size if there is one.
+void * allocateStack(size_t size) {
+
+	struct pooledStack ** trav = &stackPool;
+	while (*trav != NULL) {
+		if ((*trav)->size == size) {
+			void * ret = *trav;
+			*trav = (*trav)->next;
+			numPooledStacks--;
+			return ret;
+		}
+		trav = &((*trav)->next);
+	}
+
+	char * mapping = mmap(NULL, size + pageSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+	if (mapping == MAP_FAILED) { return NULL; }
+	if (mprotect(mapping, pageSize, PROT_NONE) == -1) {
+		munmap(mapping, size + pageSize);
+		return NULL;
+	}
+	return mapping + pageSize;
+}
+
+// Puts <stack> of <size> usable bytes in the pool,
+// or unmaps it with its guard page if the pool is full
+void freeStack(void * stack, size_t size) {
+	if (numPooledStacks < MAX_POOLED_STACKS) {
+		struct pooledStack * pooled = stack;
+		pooled->size = size;
+		pooled->next = stackPool;
+		stackPool = pooled;
+		numPooledStacks++;
+	} else { munmap(CHAR_PTR(stack) - pageSize, size + pageSize); }
 }
 
-// Initializes a new tcb
+// Initializes a new tcb, returns NULL if there is no memory for it
 tcb * getNewTcb() {
 	tcb * ret = malloc(sizeof(tcb));
+	if (ret == NULL) { return NULL; }
+	if (initializeThreadMemory(ret) == -1) {
+		free(ret);
+		return NULL;
+	}
 	ret->done = 0;
 	ret->retVal = NULL;
-	ret->waiter = NULL;
+	ret->joiners.head = NULL;
+	ret->joiners.tail = NULL;
+	ret->numJoiners = 0;
 	ret->priorityLevel = 0;
+	ret->vruntime = minVruntime;
+	ret->nice = 0;
+	ret->weight = NICE_0_WEIGHT;
+	ret->child = NULL;
+	ret->stack = NULL;
+	ret->numPages = 0;
+	ret->pages = NULL;
+	ret->sharedCache = NULL;
+	ret->next = NULL;
+	ret->previous = NULL;
+	ret->queue = NULL;
+	ret->timerNext = NULL;
+	ret->timerPrevious = NULL;
+	ret->timerSlot = NULL;
+	ret->timedOut = 0;
 	return ret;
 }
 
-// Enqueue <data> into <queue>
-void enqueue(void * data, struct queue * queue) {
+// Enqueue <thread> into <queue>
+void enqueue(tcb * thread, struct queue * queue) {
+
+	thread->queue = queue;
+	thread->previous = NULL;
+	thread->next = queue->head;
 
-	struct queueNode * node = malloc(sizeof(struct queueNode));
-	node->data = data;
-	node->previous = NULL;
+	if (queue->head == NULL) { queue->tail = thread; }
+	else { queue->head->previous = thread; }
+	queue->head = thread;
+}
 
-	if (queue->tail == NULL) {
-		node->next = NULL;
-		queue->head = node;
-		queue->tail = node;
+// Removes <thread> from <queue> and returns 1,
+// returns 0 if <thread> is not in <queue>
+char removeFromQueue(tcb * thread, struct queue * queue) {
 
-	} else {
-		node->next = queue->head;
-		queue->head->previous = node;
-		queue->head = node;
+	if (thread->queue != queue) { return 0; }
+
+	if (thread->next != NULL) { thread->next->previous = thread->previous; }
+	else { queue->tail = thread->previous; }
+
+	if (thread->previous != NULL) { thread->previous->next = thread->next; }
+	else { queue->head = thread->next; }
+
+	thread->next = NULL;
+	thread->previous = NULL;
+	thread->queue = NULL;
+	return 1;
+}
+
+// Dequeues from <queue>, NULL if <queue> is empty
+tcb * dequeue(struct queue * queue) {
+	tcb * ret = queue->tail;
+	if (ret != NULL) { removeFromQueue(ret, queue); }
+	return ret;
+}
+
+// Returns the tick of the timer wheel <time> falls in
+unsigned long long getTick(struct timeval * time) {
+	return ((unsigned long long) time->tv_sec * 1000000 + time->tv_usec) / TIMER_RESOLUTION;
+}
+
+// Returns <abstime> in microseconds, rounded up
+unsigned long long getDeadline(const struct timespec * abstime) {
+	return (unsigned long long) abstime->tv_sec * 1000000 + (abstime->tv_nsec + 999) / 1000;
+}
+
+// Links <thread> into the slot of the timer wheel for its wake tick. The
+// level is picked by how far the wake tick is, and the slot in the level
+// by the wake tick's bits for that level. Wake ticks further than the
+// wheel reaches go in the last slot it reaches and are added again when
+// that slot expires.
+void addTimer(tcb * thread) {
+
+	unsigned long long tick = thread->wakeTick;
+	if (tick <= wheelTick) { tick = wheelTick + 1; }
+	unsigned long long reach = 1ULL << (WHEEL_BITS * NUM_WHEEL_LEVELS);
+	if (tick - wheelTick >= reach) { tick = wheelTick + reach - 1; }
+
+	int level = 0;
+	while ((tick - wheelTick) >= (1ULL << (WHEEL_BITS * (level + 1)))) { level++; }
+
+	tcb ** slot = &(timerWheel[level][(tick >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)]);
+	thread->timerSlot = slot;
+	thread->timerPrevious = NULL;
+	thread->timerNext = *slot;
+	if (*slot != NULL) { (*slot)->timerPrevious = thread; }
+	*slot = thread;
+}
+
+// Unlinks <thread> from its slot of the timer wheel
+void unlinkTimer(tcb * thread) {
+	if (thread->timerNext != NULL) { thread->timerNext->timerPrevious = thread->timerPrevious; }
+	if (thread->timerPrevious != NULL) { thread->timerPrevious->timerNext = thread->timerNext; }
+	else { *(thread->timerSlot) = thread->timerNext; }
+	thread->timerNext = NULL;
+	thread->timerPrevious = NULL;
+	thread->timerSlot = NULL;
+}
+
+// Takes <thread> out of the timer wheel if it's in it
+void cancelTimer(tcb * thread) {
+	if (thread->timerSlot == NULL) { return; }
+	unlinkTimer(thread);
+	numTimers--;
+}
+
+// Melds the pairing heaps rooted at <a> and <b>, which must
+// have no siblings, and returns the root of the result
+tcb * meldHeaps(tcb * a, tcb * b) {
+	if (a == NULL) { return b; }
+	if (b == NULL) { return a; }
+	if (b->vruntime < a->vruntime) {
+		tcb * temp = a;
+		a = b;
+		b = temp;
+	}
+	b->previous = a;
+	b->next = a->child;
+	if (a->child != NULL) { a->child->previous = b; }
+	a->child = b;
+	return a;
+}
+
+// Melds the heaps in the sibling list starting at <first> in
+// two passes, pairing them from the left then melding the
+// pairs from the right, and returns the root of the result
+tcb * meldSiblings(tcb * first) {
+
+	// Pairs are kept in a list linked in reverse through next
+	tcb * pairs = NULL;
+	while (first != NULL) {
+		tcb * a = first;
+		tcb * b = a->next;
+		first = (b == NULL) ? NULL : b->next;
+		a->next = NULL;
+		a->previous = NULL;
+		if (b != NULL) {
+			b->next = NULL;
+			b->previous = NULL;
+		}
+		a = meldHeaps(a, b);
+		a->next = pairs;
+		pairs = a;
 	}
+
+	tcb * root = NULL;
+	while (pairs != NULL) {
+		tcb * pair = pairs;
+		pairs = pair->next;
+		pair->next = NULL;
+		root = meldHeaps(root, pair);
+	}
+	return root;
 }
 
-// Dequeues from <queue>
-void * dequeue(struct queue * queue) {
+// Removes <thread> from the fair scheduler's heap
+void removeFromHeap(tcb * thread) {
 
-	if (queue->tail == NULL) {
-		return NULL;
+	tcb * children = meldSiblings(thread->child);
+
+	if (thread == fairQueue.head) { fairQueue.head = children; }
+	else {
+
+		// <previous> is the parent if <thread> is the first
+		// child, otherwise it's the sibling to the left
+		if (thread->previous->child == thread) { thread->previous->child = thread->next; }
+		else { thread->previous->next = thread->next; }
+		if (thread->next != NULL) { thread->next->previous = thread->previous; }
+
+		fairQueue.head = meldHeaps(fairQueue.head, children);
+	}
+
+	thread->child = NULL;
+	thread->next = NULL;
+	thread->previous = NULL;
+	thread->queue = NULL;
+}
+
+// Puts <thread> in the priority queue of its priority level, or in the
+// fair scheduler's heap, without setting its ready time. Its deadline
+// is cancelled since it doesn't have to wait anymore.
+void insertReady(tcb * thread) {
+
+	cancelTimer(thread);
+
+	if (fairScheduling) {
+
+		// A thread that waited keeps at most FAIR_WAKEUP_CREDIT
+		// of the lead it got on the others while waiting
+		if (thread->vruntime + FAIR_WAKEUP_CREDIT < minVruntime) {
+			thread->vruntime = minVruntime - FAIR_WAKEUP_CREDIT;
+		}
+
+		thread->queue = &fairQueue;
+		thread->next = NULL;
+		thread->previous = NULL;
+		fairQueue.head = meldHeaps(fairQueue.head, thread);
 
 	} else {
-		void * data = queue->tail->data;
-		struct queueNode * newTail = queue->tail->previous;
-		free(queue->tail);
-		queue->tail = newTail;
-		return data;
+		enqueue(thread, &(PQs[thread->priorityLevel].queue));
+		readyLevels |= 1 << thread->priorityLevel;
 	}
 }
 
-// Removes <data> from <queue> and returns 1,
-// returns 0 if not found
-char removeFromQueue(void * data, struct queue * queue) {
+// Puts <thread> in the priority queue of its priority level,
+// or in the fair scheduler's heap
+void enqueueReady(tcb * thread) {
+	gettimeofday(&(thread->readyTime), NULL);
+	insertReady(thread);
+}
 
-	struct queueNode * trav = queue->tail;
+// Puts the thread switched out for <currentTcb> back in the ready
+// queues, it became ready when <currentTcb> started
+void requeuePrevious(tcb * previous) {
+	previous->readyTime = currentTcb->start;
+	insertReady(previous);
+}
 
-	while (trav != NULL) {
+// Removes <thread> from its priority queue or the fair scheduler's heap
+// and returns 1, returns 0 if <thread> is not waiting to run
+char removeFromReady(tcb * thread) {
 
-		if (trav->data == data) {
+	if (fairScheduling) {
+		if (thread->queue != &fairQueue) { return 0; }
+		removeFromHeap(thread);
+		return 1;
+	}
 
-			if (trav->next != NULL) {
-				trav->next->previous = trav->previous;
-			}
+	int level = thread->priorityLevel;
+	if (!removeFromQueue(thread, &(PQs[level].queue))) { return 0; }
+	if (PQs[level].queue.tail == NULL) { readyLevels &= ~(1 << level); }
+	return 1;
+}
 
-			if (trav->previous != NULL) {
-				trav->previous->next = trav->next;
-			}
+// Records the time <thread> waited to run in the latency histogram
+void recordLatency(tcb * thread) {
+	unsigned long latency = getElapsedTime(&(thread->readyTime), &(thread->start));
+	int bucket = (latency == 0) ? 0 : (sizeof(long) * 8) - __builtin_clzl(latency);
+	if (bucket >= NUM_LATENCY_BUCKETS) { bucket = NUM_LATENCY_BUCKETS - 1; }
+	(schedStats.latencyHistogram[bucket])++;
+	schedStats.totalLatency += latency;
+	if (latency > schedStats.maxLatency) { schedStats.maxLatency = latency; }
+	(schedStats.switches)++;
+}
 
-			free(trav);
-			return 1;
+// Wakes the threads in the slot of the current tick at <level> of the
+// timer wheel, or moves them to the levels below for the other levels
+void expireSlot(int level, struct timeval * now) {
+
+	tcb ** slot = &(timerWheel[level][(wheelTick >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)]);
+	tcb * thread = *slot;
+	*slot = NULL;
+
+	while (thread != NULL) {
+		tcb * next = thread->timerNext;
+		thread->timerNext = NULL;
+		thread->timerPrevious = NULL;
+		thread->timerSlot = NULL;
+
+		// Threads from higher levels, or past the wheel's
+		// reach, are added again until their tick comes
+		if (thread->wakeTick > wheelTick) { addTimer(thread); }
+		else {
+
+			// Take the thread out of the queue it's waiting in
+			// and tell it that its deadline passed
+			numTimers--;
+			if (thread->queue != NULL) { removeFromQueue(thread, thread->queue); }
+			thread->timedOut = 1;
+			thread->readyTime = *now;
+			insertReady(thread);
+		}
+		thread = next;
+	}
+}
+
+// Advances the timer wheel to <now> one tick at a time, moving the
+// timers of a level down every time the level below wraps around
+// and waking the threads whose deadlines passed
+void expireTimers(struct timeval * now) {
+
+	unsigned long long tick = getTick(now);
+	while (numTimers > 0 && wheelTick < tick) {
+		wheelTick++;
+		int level = 1;
+		while (level < NUM_WHEEL_LEVELS
+			&& ((wheelTick >> (WHEEL_BITS * (level - 1))) & (WHEEL_SIZE - 1)) == 0) {
+			expireSlot(level, now);
+			level++;
 		}
+		expireSlot(0, now);
+	}
 
-		trav = trav->previous;
+	// The empty wheel jumps straight to now
+	if (numTimers == 0 && wheelTick < tick) { wheelTick = tick; }
+}
+
+// Returns the earliest tick the timer wheel has to be advanced to
+// for a thread to be woken or moved down a level
+unsigned long long getNextTimerTick() {
+
+	unsigned long long next = ~0ULL;
+	int level;
+	for (level = 0; level < NUM_WHEEL_LEVELS; level++) {
+		unsigned long long base = wheelTick >> (WHEEL_BITS * level);
+		int i;
+		for (i = 1; i <= WHEEL_SIZE; i++) {
+			if (timerWheel[level][(base + i) & (WHEEL_SIZE - 1)] != NULL) {
+				unsigned long long tick = (base + i) << (WHEEL_BITS * level);
+				if (tick < next) { next = tick; }
+				break;
+			}
+		}
 	}
+	return next;
+}
 
+// Registers <fd> with epoll for <events> and the events its waiting
+// threads need, or unregisters it if there are none. Returns 0 on
+// success, or -1 if epoll can't watch <fd>.
+int updateIoEvents(int fd, unsigned int events) {
+
+	struct ioWait * wait = ioWaits[fd];
+	if (wait->readers.tail != NULL) { events |= EPOLLIN; }
+	if (wait->writers.tail != NULL) { events |= EPOLLOUT; }
+	if (events == wait->events) { return 0; }
+
+	struct epoll_event event;
+	event.events = events;
+	event.data.fd = fd;
+	if (events == 0) { epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, &event); }
+
+	// The descriptor may have been closed and reopened
+	// since, dropping its old registration
+	else if (wait->events == 0 || epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) < 0) {
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			wait->events = 0;
+			return -1;
+		}
+	}
+	wait->events = events;
 	return 0;
 }
 
-// Returns the next tcb and removes it from the queue,
-// NULL if no threads in queue
+// Moves every thread in <queue> of waiting threads to the ready queues
+void wakeIoWaiters(struct queue * queue) {
+	tcb * waiter;
+	while ((waiter = dequeue(queue)) != NULL) {
+		numIoWaiters--;
+		enqueueReady(waiter);
+	}
+}
+
+// Wakes the threads waiting on the file descriptors epoll reports
+// ready, waiting up to <timeout> milliseconds like epoll_wait
+void pollIo(int timeout) {
+
+	struct epoll_event events[MAX_IO_EVENTS];
+	int numEvents = epoll_wait(epollFd, events, MAX_IO_EVENTS, timeout);
+
+	int i;
+	for (i = 0; i < numEvents; i++) {
+
+		// Errors and hang ups wake both sides so
+		// their calls can return what happened
+		int fd = events[i].data.fd;
+		if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) { wakeIoWaiters(&(ioWaits[fd]->readers)); }
+		if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) { wakeIoWaiters(&(ioWaits[fd]->writers)); }
+		updateIoEvents(fd, 0);
+	}
+}
+
+// Returns the next tcb and removes it from the queue, NULL if no
+// threads in queue. The returned thread's start time is set to now.
+// Threads whose deadlines passed or whose file descriptors are
+// ready are woken first.
 tcb * getNextTcb() {
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	expireTimers(&now);
+	if (numIoWaiters > 0) { pollIo(0); }
+
+	tcb * ret;
+
+	// The fair scheduler runs the thread that has had
+	// the least weighted run time
+	if (fairScheduling) {
+		ret = fairQueue.head;
+		if (ret == NULL) { return NULL; }
+		removeFromHeap(ret);
+		if (ret->vruntime > minVruntime) { minVruntime = ret->vruntime; }
+
+	} else {
+		if (!readyLevels) { return NULL; }
+		int level = __builtin_ctz(readyLevels);
+		ret = dequeue(&(PQs[level].queue));
+		if (PQs[level].queue.tail == NULL) { readyLevels &= ~(1 << level); }
+	}
+
+	ret->start = now;
+	recordLatency(ret);
+	return ret;
+}
+
+// Returns the next tcb like getNextTcb, but when no thread is ready and
+// some are waiting with a deadline or on a file descriptor, the process
+// sleeps in epoll_wait, or nanosleep if no thread waits on a descriptor,
+// until the timer wheel's next tick with a timer or a descriptor is
+// ready. Returns NULL only if no thread is ready or waiting for either.
+tcb * waitForNextTcb() {
+
+	tcb * next;
+	while ((next = getNextTcb()) == NULL && (numTimers > 0 || numIoWaiters > 0)) {
+
+		unsigned long long idleTime = ~0ULL;
+		if (numTimers > 0) {
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			unsigned long long wake = getNextTimerTick() * TIMER_RESOLUTION;
+			unsigned long long time = (unsigned long long) now.tv_sec * 1000000 + now.tv_usec;
+			idleTime = (wake > time) ? wake - time : 0;
+		}
+
+		if (numIoWaiters > 0) {
+			pollIo((idleTime == ~0ULL) ? -1 : (int) ((idleTime + 999) / 1000));
+		} else if (idleTime > 0) {
+			struct timespec idle;
+			idle.tv_sec = idleTime / 1000000;
+			idle.tv_nsec = (idleTime % 1000000) * 1000;
+			nanosleep(&idle, NULL);
+		}
+	}
+	return next;
+}
+
+// Adds the time <thread> ran since its start time to its vruntime,
+// weighted by its nice value, and restarts its start time at <now>.
+// Only done for the fair scheduler since MLFQ measures time slices
+// from the start time.
+void chargeRunTime(tcb * thread, struct timeval * now) {
+	if (!fairScheduling) { return; }
+	suseconds_t ranTime = getElapsedTime(&(thread->start), now);
+	if (ranTime > 0) { thread->vruntime += (ranTime * NICE_0_WEIGHT) / thread->weight; }
+	thread->start = *now;
+
+	// The running thread counts for the smallest vruntime when it's
+	// ahead of the heap, so threads waking after it ran alone for a
+	// while don't get all that time as a lead
+	if ((fairQueue.head == NULL || thread->vruntime < fairQueue.head->vruntime)
+		&& thread->vruntime > minVruntime) {
+		minVruntime = thread->vruntime;
+	}
+}
+
+// Charges the running thread for the time it ran until now
+void chargeCurrentTcb() {
+	if (!fairScheduling) { return; }
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	chargeRunTime(currentTcb, &now);
+}
+
+// Entry point of every thread created with my_pthread_create
+void startThread() {
+	my_pthread_exit(currentTcb->function(currentTcb->arg));
+	// Only reached if there are no threads left to run
+	exit(EXIT_SUCCESS);
+}
+
+// Prepares <thread> to run startThread on the
+// <stackSize> bytes of stack starting at <stack>
+void initializeContext(tcb * thread, void * stack, size_t stackSize) {
+	thread->stack = stack;
+	thread->stackSize = stackSize;
+#ifdef FAST_SWITCH
+	// Build the frame switchStacks pops, returning into
+	// startThread with the stack aligned like after a call
+	void ** top = (void **) ((UNSGND_LONG(stack) + stackSize) & ~15UL);
+	*(--top) = NULL;
+	*(--top) = (void *) startThread;
 	int i;
-	for (i = 0; i < NUM_PRIORITY_LVLS; i++) {
-		tcb * ret = dequeue(&(PQs[i].queue));
-		if (ret != NULL) { return ret; }
+	for (i = 0; i < NUM_SAVED_REGISTERS; i++) { *(--top) = NULL; }
+	*(--top) = (void *) INITIAL_FP_CONTROL;
+	thread->stackPointer = top;
+#else
+	getcontext(&(thread->context));
+	thread->context.uc_link = NULL;
+	thread->context.uc_stack.ss_size = stackSize;
+	thread->context.uc_stack.ss_sp = stack;
+	makecontext(&(thread->context), startThread, 0);
+#endif
+}
+
+// Saves the context of <previous> and runs <next>
+void switchThreads(tcb * previous, tcb * next) {
+#ifdef FAST_SWITCH
+	switchStacks(&(previous->stackPointer), next->stackPointer);
+#else
+	swapcontext(&(previous->context), &(next->context));
+#endif
+}
+
+// Runs <next> without saving the running context
+void runThread(tcb * next) {
+#ifdef FAST_SWITCH
+	switchStacks(&discardedStackPointer, next->stackPointer);
+#else
+	setcontext(&(next->context));
+#endif
+}
+
+// Parks the running thread in <queue>, or only in the timer wheel if
+// <queue> is NULL, and runs the next thread. If <deadline> isn't 0, the
+// thread is woken when the time of day passes <deadline> microseconds.
+// The scheduler must be blocked, and is unblocked when it returns.
+// Returns 1 if the thread was woken because its deadline passed.
+char waitInQueueUntil(struct queue * queue, unsigned long long deadline) {
+
+	tcb * previousTcb = currentTcb;
+	previousTcb->timedOut = 0;
+
+	// Park the thread before picking the next one
+	// so its deadline can wake it while idling
+	if (deadline != 0) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		if (deadline <= (unsigned long long) now.tv_sec * 1000000 + now.tv_usec) {
+			block = 0;
+			return 1;
+		}
+		expireTimers(&now);
+		previousTcb->wakeTick = (deadline + TIMER_RESOLUTION - 1) / TIMER_RESOLUTION;
+		addTimer(previousTcb);
+		numTimers++;
+	}
+	if (queue != NULL) { enqueue(previousTcb, queue); }
+
+	chargeCurrentTcb();
+	currentTcb = waitForNextTcb();
+	if (currentTcb == NULL) {
+		fprintf(stderr, "Deadlock: every thread is waiting\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// The thread's own deadline may have passed while idling
+	if (currentTcb != previousTcb) {
+		protectAllPages(previousTcb);
+		unprotectAllPages(currentTcb);
+		block = 0;
+		switchThreads(previousTcb, currentTcb);
+	} else { block = 0; }
+
+	return currentTcb->timedOut;
+}
+
+// Parks the running thread in <queue> and runs the next thread. The
+// scheduler must be blocked, and is unblocked when it returns.
+void waitInQueue(struct queue * queue) {
+	waitInQueueUntil(queue, 0);
+}
+
+// Moves the longest waiting thread in <queue> to the priority
+// queue of its level. Returns 0 if <queue> is empty else returns 1.
+char wakeFromQueue(struct queue * queue) {
+	tcb * waiter = dequeue(queue);
+	if (waiter == NULL) { return 0; }
+	enqueueReady(waiter);
+	return 1;
+}
+
+// Locks <mutex> for the running thread, parking it while another
+// thread holds it until <deadline> like waitInQueueUntil. The scheduler
+// must be blocked, and is unblocked when it returns. There is only one
+// kernel thread so the locker can't be running while another thread
+// waits, and spinning would only burn the rest of the time slice.
+// Returns 0 if the mutex was locked, or ETIMEDOUT.
+int acquireMutex(my_pthread_mutex_t * mutex, unsigned long long deadline) {
+
+	if (mutex->locker != NULL) { (mutex->contentions)++; }
+
+	// Unlocking wakes a waiter without giving it the lock, so a
+	// woken waiter has to check the lock again
+	while (mutex->locker != NULL) {
+
+		// Increases priority of the locker to the priority of the waiter
+		// if the waiter's priority is higher for priority inversion
+		if (currentTcb->priorityLevel > mutex->locker->priorityLevel) {
+			char lockerReady = removeFromReady(mutex->locker);
+			mutex->locker->priorityLevel = currentTcb->priorityLevel;
+			if (lockerReady) { enqueueReady(mutex->locker); }
+		}
+
+		(mutex->waits)++;
+		if (waitInQueueUntil(&(mutex->waiters), deadline)) { return ETIMEDOUT; }
+		block = 1;
+	}
+
+	(mutex->acquisitions)++;
+	mutex->locker = currentTcb;
+	block = 0;
+	return 0;
+}
+
+// Unlocks <mutex> if the running thread holds it and wakes the longest
+// waiting thread. The lock isn't handed to the waiter so the unlocking
+// thread can lock it again in the same time slice instead of every
+// lock after a contended one costing a context switch. The scheduler
+// must be blocked.
+void releaseMutex(my_pthread_mutex_t * mutex) {
+
+	if (mutex->locker != currentTcb) { return; }
+	mutex->locker = NULL;
+
+	// Put the waiter on the queue with the priority level of the
+	// unlocker aka the highest priority level of all the waiters
+	// for the priority inversion
+	tcb * waiter = dequeue(&(mutex->waiters));
+	if (waiter != NULL) {
+		waiter->priorityLevel = currentTcb->priorityLevel;
+		enqueueReady(waiter);
 	}
-	return NULL;
 }
 
 // Schedules threads
 void schedule(int signum) {
 
-	// Only run if scheduler isn't blocked
-	if (!__sync_val_compare_and_swap(&block, 0, 1)) {
+	// Only run if scheduler isn't blocked and, when fired by the
+	// timer, the interrupted thread isn't waiting on a fault
+	if (!(signum && isResolvingFault()) && !__sync_val_compare_and_swap(&block, 0, 1)) {
 
-		// Get the runtime of the previous thread
+		// Wake the threads whose deadlines passed
+		// or whose file descriptors are ready
 		struct timeval now;
 		gettimeofday(&now, NULL);
-		suseconds_t previousRunTime = 0;
-		unsigned int previousTimeSlice = 0;
+		expireTimers(&now);
+		if (numIoWaiters > 0) { pollIo(0); }
+
+		// Get the runtime of the previous thread
+		char timeUp = 1;
+		char sliceUsed = 0;
 		if (currentTcb != NULL) {
-			previousRunTime = getElapsedTime(&(currentTcb->start), &now);
-			previousTimeSlice = PQs[currentTcb->priorityLevel].timeSlice;
+
+			// The fair scheduler switches as soon as another thread has
+			// had less weighted run time, MLFQ at the end of the time
+			// slice of the thread's priority level, or before it if a
+			// thread of a higher priority level is ready, like one
+			// whose deadline just passed
+			if (fairScheduling) {
+				chargeRunTime(currentTcb, &now);
+				timeUp = fairQueue.head != NULL && fairQueue.head->vruntime < currentTcb->vruntime;
+			} else {
+				suseconds_t previousRunTime = getElapsedTime(&(currentTcb->start), &now);
+				sliceUsed = previousRunTime >= PQs[currentTcb->priorityLevel].timeSlice;
+				timeUp = sliceUsed || (readyLevels & ((1 << currentTcb->priorityLevel) - 1));
+			}
 		}
 
 		// If thread ran long enough or no previous thread, context switch
-		if (previousRunTime >= previousTimeSlice) {
+		if (timeUp) {
 
-			tcb * nextTcb = getNextTcb();
+			// With no previous thread, idle until a
+			// thread waiting for a deadline wakes
+			tcb * nextTcb = (currentTcb == NULL) ? waitForNextTcb() : getNextTcb();
 
 			// If there is a thread in the queue, schedule it next
 			if (nextTcb != NULL) {
@@ -176,27 +909,28 @@ void schedule(int signum) {
 				// Run the next thread, and save the previous thread
 				// if there is one
 				if (previousTcb == NULL) { 
-					gettimeofday(&(currentTcb->start), NULL);
 					block = 0;
 					unprotectAllPages(currentTcb);
-					setcontext(&(currentTcb->context));
+					runThread(currentTcb);
 
 				} else {
 
 					// Decrease the priority level of previous thread if not already
 					// at the lowest priority, else increase to highest priority
-					// as the maintenance cycle
-					if (previousTcb->priorityLevel < (NUM_PRIORITY_LVLS - 1)) {
-						(previousTcb->priorityLevel)++;
-					} else { previousTcb->priorityLevel = 0; }
+					// as the maintenance cycle. A thread switched out before the
+					// end of its time slice keeps its level.
+					if (sliceUsed) {
+						if (previousTcb->priorityLevel < (NUM_PRIORITY_LVLS - 1)) {
+							(previousTcb->priorityLevel)++;
+						} else { previousTcb->priorityLevel = 0; }
+					}
 
 					// Swap the threads
-					enqueue(previousTcb, &(PQs[previousTcb->priorityLevel].queue));
-					gettimeofday(&(currentTcb->start), NULL);
+					requeuePrevious(previousTcb);
 					block = 0;
 					protectAllPages(previousTcb);
 					unprotectAllPages(currentTcb);
-					swapcontext(&(previousTcb->context), &(currentTcb->context));
+					switchThreads(previousTcb, currentTcb);
 				}
 		
 			} else { block = 0; }
@@ -217,16 +951,20 @@ void initializeThreads() {
 		// Initialize the priority queues
 		initializePQs();
 
-		// Save pthread_exit context
-		getcontext(&exitContext);
-		void * exitStack = malloc(TEMP_SIZE);
-		exitContext.uc_link = NULL;
-		exitContext.uc_stack.ss_size = TEMP_SIZE;
-		exitContext.uc_stack.ss_sp = exitStack;
-		makecontext(&exitContext, (void (*)(void)) my_pthread_exit, 1, NULL);
-
-		// Catch itimer signal
-		signal(SIGVTALRM, schedule);
+		// Pick the scheduler
+		char * scheduler = getenv(SCHEDULER_ENV);
+		fairScheduling = scheduler != NULL && strcmp(scheduler, "fair") == 0;
+		schedStats.fair = fairScheduling;
+
+		// Catch itimer signal. SA_NODEFER keeps the signal mask
+		// untouched while in the handler so threads can be switched
+		// from inside it without restoring masks; reentry is
+		// prevented by <block> instead.
+		struct sigaction sa;
+		sa.sa_flags = SA_NODEFER | SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sa.sa_handler = schedule;
+		sigaction(SIGVTALRM, &sa, NULL);
 
 		// Start itimer
 		struct itimerval * timer = malloc(sizeof(struct itimerval));
@@ -238,6 +976,11 @@ void initializeThreads() {
 
 		// Cretae tcb for first caller
 		currentTcb = getNewTcb();
+		if (currentTcb == NULL) {
+			fprintf(stderr, "Error allocating the main thread's tcb\n");
+			exit(EXIT_FAILURE);
+		}
+		gettimeofday(&(currentTcb->start), NULL);
 
 		initialized = 1;
 		block = 0;
@@ -250,16 +993,29 @@ int my_pthread_create(my_pthread_t * thread, pthread_attr_t * attr, void *(*func
 	initializeThreads();
 	block = 1;
 
+	// Use the attribute's stack size rounded up to whole pages
+	size_t stackSize = STACK_SIZE;
+	if (attr != NULL) { pthread_attr_getstacksize(attr, &stackSize); }
+	stackSize = (stackSize + pageSize - 1) & ~(pageSize - 1);
+
+	void * stack = allocateStack(stackSize);
+	if (stack == NULL) {
+		block = 0;
+		return EAGAIN;
+	}
+
 	// Create the new thread and add it to high priority
 	tcb * newTcb = getNewTcb();
-	getcontext(&(newTcb->context));
-	void * newThreadStack = malloc(TEMP_SIZE);
-	newTcb->context.uc_link = &exitContext;
-	newTcb->context.uc_stack.ss_size = TEMP_SIZE;
-	newTcb->context.uc_stack.ss_sp = newThreadStack;
-	makecontext(&(newTcb->context), (void (*)(void)) function, 1, arg);
+	if (newTcb == NULL) {
+		freeStack(stack, stackSize);
+		block = 0;
+		return EAGAIN;
+	}
+	newTcb->function = function;
+	newTcb->arg = arg;
+	initializeContext(newTcb, stack, stackSize);
 	*thread = newTcb;
-	enqueue(newTcb, &(PQs[0].queue));
+	enqueueReady(newTcb);
 
 	block = 0;
 	return 0;
@@ -270,6 +1026,7 @@ int my_pthread_yield() {
 
 	block = 1;
 
+	chargeCurrentTcb();
 	tcb * nextTcb = getNextTcb();
 	
 	// If there is a thread in the queue, run that and save the
@@ -277,12 +1034,11 @@ int my_pthread_yield() {
 	if (nextTcb != NULL) {
 		tcb * previousTcb = currentTcb;
 		currentTcb = nextTcb;
-		gettimeofday(&(currentTcb->start), NULL);
-		enqueue(previousTcb, &(PQs[previousTcb->priorityLevel].queue));
+		requeuePrevious(previousTcb);
 		protectAllPages(previousTcb);
 		unprotectAllPages(currentTcb);
 		block = 0;
-		swapcontext(&(previousTcb->context), &(currentTcb->context));
+		switchThreads(previousTcb, currentTcb);
 	}
 
 	block = 0;
@@ -299,132 +1055,613 @@ void my_pthread_exit(void *value_ptr) {
 	currentTcb->done = 1;
 	currentTcb->retVal = value_ptr;
 
-	// If the exiting thread has another thread
-	// waiting on it, put the waiting thread in
-	// the queue so it can be run later
-	if (currentTcb->waiter != NULL) {
-		currentTcb->waiter->priorityLevel = 0;
-		enqueue(currentTcb->waiter, &(PQs[0].queue));
+	// If the exiting thread has other threads
+	// waiting on it, put the waiting threads in
+	// the queue so they can be run later
+	tcb * joiner;
+	while ((joiner = dequeue(&(currentTcb->joiners))) != NULL) {
+		joiner->priorityLevel = 0;
+		enqueueReady(joiner);
 	}
 
-	protectAllPages(currentTcb);
+	// Give back the exiting thread's pages and cached shared blocks
+	tcb * exiting = currentTcb;
+	protectAllPages(exiting);
 	currentTcb = NULL;
+	releaseThreadMemory(exiting);
+	releaseSharedCache(exiting);
 
 	block = 0;
 	schedule(0);
 };
 
-/* wait for thread termination */
-int my_pthread_join(my_pthread_t thread, void **value_ptr) {
+// Waits for <thread> to terminate until <deadline> like waitInQueueUntil
+// and releases it once every thread joining it has its return value.
+// Returns 0 if it terminated, or ETIMEDOUT.
+int joinThread(my_pthread_t thread, void **value_ptr, unsigned long long deadline) {
 
 	block = 1;
 
-	// Retrieve the tcb of the joining thread
+	// Retrieve the tcb of the joining thread, counting
+	// this thread as joining it until it leaves
 	tcb * joining = thread;
+	(joining->numJoiners)++;
 
-	// If the the joining thread isn't done,
-	// refrence the waiting (this) thread in
-	// the joining thread's tcb and wait
+	// If the the joining thread isn't done, wait
+	// in the joining thread's queue of joiners. It's
+	// left for a later join if the deadline passes.
 	if (!(joining->done)) {
-
-		// Swap the waiter with the next thread
-		joining->waiter = currentTcb;
-		currentTcb = getNextTcb();
-		gettimeofday(&(currentTcb->start), NULL);
-		protectAllPages(joining->waiter);
-		unprotectAllPages(currentTcb);
-		block = 0;
-		swapcontext(&(joining->waiter->context), &(currentTcb->context));
+		if (waitInQueueUntil(&(joining->joiners), deadline)) {
+			block = 1;
+			(joining->numJoiners)--;
+			block = 0;
+			return ETIMEDOUT;
+		}
+		block = 1;
 	}
 
-	block = 0;
-
 	// If <value_ptr> is not null, make it point to the
 	// joining thread's return value.
 	if (value_ptr != NULL) { *value_ptr = joining->retVal; }
 
 	// Release ressources of the joining thread
-	free(joining->context.uc_stack.ss_sp);
-	free(joining);
+	// if no other thread is still joining it
+	if (--(joining->numJoiners) == 0) {
+		freeStack(joining->stack, joining->stackSize);
+		free(joining);
+	}
+
+	block = 0;
+	return 0;
+}
+
+/* wait for thread termination */
+int my_pthread_join(my_pthread_t thread, void **value_ptr) {
+	return joinThread(thread, value_ptr, 0);
+};
+
+/* wait for thread termination until an absolute time */
+int my_pthread_timedjoin(my_pthread_t thread, void **value_ptr, const struct timespec *abstime) {
+	if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000) { return EINVAL; }
+	return joinThread(thread, value_ptr, getDeadline(abstime));
+};
+
+/* suspend the calling thread for a number of microseconds */
+int my_pthread_sleep(useconds_t microseconds) {
+
+	initializeThreads();
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	unsigned long long deadline = (unsigned long long) now.tv_sec * 1000000 + now.tv_usec + microseconds;
+
+	// Wait in the timer wheel only, off every queue
+	block = 1;
+	waitInQueueUntil(NULL, deadline);
+
+	return 0;
+};
+
+/* set the nice value of a thread for the fair scheduler */
+int my_pthread_setnice(my_pthread_t thread, int nice) {
+
+	if (nice < MIN_NICE || nice > MAX_NICE) { return EINVAL; }
+
+	// Charge the running thread at its old weight before
+	// changing it, the new weight counts from now on
+	block = 1;
+	tcb * target = thread;
+	if (target == currentTcb) { chargeCurrentTcb(); }
+	target->nice = nice;
+	target->weight = niceWeights[nice - MIN_NICE];
+	block = 0;
 
 	return 0;
 };
 
+/* get the nice value of a thread */
+int my_pthread_getnice(my_pthread_t thread) {
+	return ((tcb *) thread)->nice;
+};
+
+/* get the scheduler counters */
+void getSchedulerStats(struct schedulerStats * stats) {
+
+	block = 1;
+	*stats = schedStats;
+	block = 0;
+
+	// Find the buckets the 50th and 99th percentiles fall in, their
+	// upper bounds can't be above the largest latency seen
+	unsigned long p50 = (stats->switches + 1) / 2;
+	unsigned long p99 = stats->switches - (stats->switches / 100);
+	unsigned long seen = 0;
+	int i;
+	for (i = 0; i < NUM_LATENCY_BUCKETS; i++) {
+		seen += stats->latencyHistogram[i];
+		unsigned long bound = (i == NUM_LATENCY_BUCKETS - 1 || (1UL << i) > stats->maxLatency) ? stats->maxLatency : (1UL << i);
+		if (stats->p50Latency == 0 && seen >= p50 && seen > 0) { stats->p50Latency = bound; }
+		if (stats->p99Latency == 0 && seen >= p99 && seen > 0) { stats->p99Latency = bound; }
+	}
+};
+
 /* initial the mutex lock */
 int my_pthread_mutex_init(my_pthread_mutex_t *mutex, const pthread_mutexattr_t *mutexattr) {
 	mutex->locker = NULL;
-	mutex->waiters = malloc(sizeof(struct queue));
-	mutex->waiters->head = NULL;
-	mutex->waiters->tail = NULL;
+	mutex->waiters.head = NULL;
+	mutex->waiters.tail = NULL;
+	mutex->acquisitions = 0;
+	mutex->contentions = 0;
+	mutex->waits = 0;
 	return 0;
 };
 
 /* aquire the mutex lock */
 int my_pthread_mutex_lock(my_pthread_mutex_t *mutex) {
+	block = 1;
+	return acquireMutex(mutex, 0);
+};
 
-	while (__sync_lock_test_and_set(&(mutex->guard), 1));
+/* aquire the mutex lock, waiting no later than an absolute time */
+int my_pthread_mutex_timedlock(my_pthread_mutex_t *mutex, const struct timespec *abstime) {
+	if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000) { return EINVAL; }
+	block = 1;
+	return acquireMutex(mutex, getDeadline(abstime));
+};
 
-	if (mutex->locker != NULL) {
+/* release the mutex lock */
+int my_pthread_mutex_unlock(my_pthread_mutex_t *mutex) {
+	block = 1;
+	releaseMutex(mutex);
+	block = 0;
+	return 0;
+};
 
-		// Swap the locked waiter with the next thread
-		block = 1;
-		tcb * previousTcb = currentTcb;
-		currentTcb = getNextTcb();
-		enqueue(previousTcb, mutex->waiters);
-		mutex->guard = 0;
+/* destroy the mutex */
+int my_pthread_mutex_destroy(my_pthread_mutex_t *mutex) {
+	return mutex->locker == NULL ? 0 : EBUSY;
+};
 
-		// Increases priority of the locker to the priority of the waiter
-		// if the waiter's priority is higher for priority inversion
-		if (previousTcb->priorityLevel > mutex->locker->priorityLevel) {
-			removeFromQueue(mutex->locker, &(PQs[mutex->locker->priorityLevel].queue));
-			mutex->locker->priorityLevel = previousTcb->priorityLevel;
-			enqueue(mutex->locker, &(PQs[mutex->locker->priorityLevel].queue));
-		}
+/* initial the condition variable */
+int my_pthread_cond_init(my_pthread_cond_t *cond, const pthread_condattr_t *condattr) {
+	cond->waiters.head = NULL;
+	cond->waiters.tail = NULL;
+	return 0;
+};
 
-		gettimeofday(&(currentTcb->start), NULL);
-		protectAllPages(previousTcb);
-		unprotectAllPages(currentTcb);
+/* release the mutex and wait for the condition variable to be signaled */
+int my_pthread_cond_wait(my_pthread_cond_t *cond, my_pthread_mutex_t *mutex) {
+
+	// Unlocking and parking with the scheduler blocked
+	// so a signal can't come between them and be lost
+	block = 1;
+	releaseMutex(mutex);
+	waitInQueue(&(cond->waiters));
+
+	block = 1;
+	acquireMutex(mutex, 0);
+	return 0;
+};
+
+/* wake one thread waiting on the condition variable */
+int my_pthread_cond_signal(my_pthread_cond_t *cond) {
+	block = 1;
+	wakeFromQueue(&(cond->waiters));
+	block = 0;
+	return 0;
+};
+
+/* wake all threads waiting on the condition variable */
+int my_pthread_cond_broadcast(my_pthread_cond_t *cond) {
+	block = 1;
+	while (wakeFromQueue(&(cond->waiters)));
+	block = 0;
+	return 0;
+};
+
+/* destroy the condition variable */
+int my_pthread_cond_destroy(my_pthread_cond_t *cond) {
+	return cond->waiters.tail == NULL ? 0 : EBUSY;
+};
+
+/* initial the semaphore */
+int my_sem_init(my_sem_t *sem, int pshared, unsigned int value) {
+	sem->value = value;
+	sem->waiters.head = NULL;
+	sem->waiters.tail = NULL;
+	return 0;
+};
+
+/* wait for the semaphore to be above 0 and decrement it */
+int my_sem_wait(my_sem_t *sem) {
+
+	// Take a unit if there is one, otherwise wait for
+	// a post to hand one over
+	block = 1;
+	if (sem->value > 0) {
+		sem->value--;
 		block = 0;
-		swapcontext(&(previousTcb->context), &(currentTcb->context));
+	} else { waitInQueue(&(sem->waiters)); }
 
-	} else {
-		mutex->locker = currentTcb;
-		mutex->guard = 0;
+	return 0;
+};
+
+/* decrement the semaphore if it's above 0 without waiting */
+int my_sem_trywait(my_sem_t *sem) {
+	block = 1;
+	int ret = 0;
+	if (sem->value > 0) { sem->value--; }
+	else {
+		errno = EAGAIN;
+		ret = -1;
 	}
+	block = 0;
+	return ret;
+};
+
+/* increment the semaphore */
+int my_sem_post(my_sem_t *sem) {
+
+	// Hand the unit to the longest waiting thread if there
+	// is one so no other thread can take it first
+	block = 1;
+	if (!wakeFromQueue(&(sem->waiters))) { sem->value++; }
+	block = 0;
 
 	return 0;
 };
 
-/* release the mutex lock */
-int my_pthread_mutex_unlock(my_pthread_mutex_t *mutex) {
+/* get the value of the semaphore */
+int my_sem_getvalue(my_sem_t *sem, int *value) {
+	*value = sem->value;
+	return 0;
+};
+
+/* destroy the semaphore */
+int my_sem_destroy(my_sem_t *sem) {
+	if (sem->waiters.tail != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	return 0;
+};
+
+/* initial the barrier */
+int my_pthread_barrier_init(my_pthread_barrier_t *barrier, const pthread_barrierattr_t *barrierattr, unsigned int count) {
+	if (count == 0) { return EINVAL; }
+	barrier->count = count;
+	barrier->waiting = 0;
+	barrier->waiters.head = NULL;
+	barrier->waiters.tail = NULL;
+	return 0;
+};
 
-	if (mutex->locker == currentTcb) {
+/* wait for all threads to reach the barrier */
+int my_pthread_barrier_wait(my_pthread_barrier_t *barrier) {
 
-		while (__sync_lock_test_and_set(&(mutex->guard), 1));
+	block = 1;
+
+	// The last thread to arrive wakes the rest and
+	// starts the next round of the barrier
+	if (++(barrier->waiting) == barrier->count) {
+		barrier->waiting = 0;
+		while (wakeFromQueue(&(barrier->waiters)));
+		block = 0;
+		return PTHREAD_BARRIER_SERIAL_THREAD;
+	}
+
+	waitInQueue(&(barrier->waiters));
+	return 0;
+};
+
+/* destroy the barrier */
+int my_pthread_barrier_destroy(my_pthread_barrier_t *barrier) {
+	return barrier->waiting == 0 ? 0 : EBUSY;
+};
 
-		tcb * waiter = dequeue(mutex->waiters);
+/* initial the reader-writer lock */
+int my_pthread_rwlock_init(my_pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *rwlockattr) {
+	rwlock->readers = 0;
+	rwlock->writer = NULL;
+	rwlock->waitingWriters = 0;
+	rwlock->readWaiters.head = NULL;
+	rwlock->readWaiters.tail = NULL;
+	rwlock->writeWaiters.head = NULL;
+	rwlock->writeWaiters.tail = NULL;
+	rwlock->readAcquisitions = 0;
+	rwlock->readContentions = 0;
+	rwlock->writeAcquisitions = 0;
+	rwlock->writeContentions = 0;
+	return 0;
+};
 
-		// If no thread is waiting on the lock then release it
-		// otherwise put the waiter on the queue with the priority
-		// level of the unloker aka the highest priority level of
-		// all the waiters for the priority inversion
-		if (waiter == NULL) {
-			mutex->locker = NULL;
+/* aquire the reader-writer lock for reading */
+int my_pthread_rwlock_rdlock(my_pthread_rwlock_t *rwlock) {
 
-		} else {
-			waiter->priorityLevel = mutex->locker->priorityLevel;
-			mutex->locker = waiter;
-			enqueue(waiter, &(PQs[waiter->priorityLevel].queue));
+	block = 1;
+	(rwlock->readAcquisitions)++;
+
+	// Wait behind a writer that holds or is waiting for
+	// the lock so readers can't starve writers
+	if (rwlock->writer != NULL || rwlock->waitingWriters > 0) {
+		(rwlock->readContentions)++;
+		do {
+			waitInQueue(&(rwlock->readWaiters));
+			block = 1;
+		} while (rwlock->writer != NULL || rwlock->waitingWriters > 0);
+	}
+
+	(rwlock->readers)++;
+	block = 0;
+	return 0;
+};
+
+/* aquire the reader-writer lock for reading if it can be done without waiting */
+int my_pthread_rwlock_tryrdlock(my_pthread_rwlock_t *rwlock) {
+	block = 1;
+	int ret = EBUSY;
+	if (rwlock->writer == NULL && rwlock->waitingWriters == 0) {
+		(rwlock->readAcquisitions)++;
+		(rwlock->readers)++;
+		ret = 0;
+	}
+	block = 0;
+	return ret;
+};
+
+/* aquire the reader-writer lock for writing */
+int my_pthread_rwlock_wrlock(my_pthread_rwlock_t *rwlock) {
+
+	block = 1;
+	(rwlock->writeAcquisitions)++;
+
+	// Wait for the readers or writer to leave. The writer counts as
+	// waiting until it has the lock, including after being woken,
+	// so readers coming in before it runs are held back.
+	if (rwlock->writer != NULL || rwlock->readers > 0) {
+		(rwlock->writeContentions)++;
+		(rwlock->waitingWriters)++;
+		do {
+			waitInQueue(&(rwlock->writeWaiters));
+			block = 1;
+		} while (rwlock->writer != NULL || rwlock->readers > 0);
+		(rwlock->waitingWriters)--;
+	}
+
+	rwlock->writer = currentTcb;
+	block = 0;
+	return 0;
+};
+
+/* aquire the reader-writer lock for writing if it can be done without waiting */
+int my_pthread_rwlock_trywrlock(my_pthread_rwlock_t *rwlock) {
+	block = 1;
+	int ret = EBUSY;
+	if (rwlock->writer == NULL && rwlock->readers == 0) {
+		(rwlock->writeAcquisitions)++;
+		rwlock->writer = currentTcb;
+		ret = 0;
+	}
+	block = 0;
+	return ret;
+};
+
+/* release the reader-writer lock */
+int my_pthread_rwlock_unlock(my_pthread_rwlock_t *rwlock) {
+
+	block = 1;
+
+	if (rwlock->writer == currentTcb) { rwlock->writer = NULL; }
+	else if (rwlock->readers > 0) { (rwlock->readers)--; }
+	else {
+		block = 0;
+		return EPERM;
+	}
+
+	// When the last holder leaves, wake the longest waiting writer,
+	// or every waiting reader if no writer is waiting. Like the mutex
+	// the lock isn't handed over, so woken threads check it again.
+	if (rwlock->writer == NULL && rwlock->readers == 0) {
+		if (!wakeFromQueue(&(rwlock->writeWaiters)) && rwlock->waitingWriters == 0) {
+			while (wakeFromQueue(&(rwlock->readWaiters)));
 		}
+	}
+
+	block = 0;
+	return 0;
+};
 
-		mutex->guard = 0;
+/* destroy the reader-writer lock */
+int my_pthread_rwlock_destroy(my_pthread_rwlock_t *rwlock) {
+	return (rwlock->writer == NULL && rwlock->readers == 0) ? 0 : EBUSY;
+};
+
+// Returns the waiting threads of <fd>, creating them and the
+// epoll instance if needed. Returns NULL if they can't be created.
+struct ioWait * getIoWait(int fd) {
+
+	if (epollFd < 0) {
+		epollFd = epoll_create1(EPOLL_CLOEXEC);
+		if (epollFd < 0) { return NULL; }
+	}
+
+	// Grow the table to fit <fd>
+	if (fd >= numIoWaits) {
+		int size = (numIoWaits == 0) ? 64 : numIoWaits * 2;
+		while (size <= fd) { size *= 2; }
+		struct ioWait ** table = malloc(size * sizeof(struct ioWait *));
+		if (table == NULL) { return NULL; }
+		if (ioWaits != NULL) { memcpy(table, ioWaits, numIoWaits * sizeof(struct ioWait *)); }
+		memset(table + numIoWaits, 0, (size - numIoWaits) * sizeof(struct ioWait *));
+		free(ioWaits);
+		ioWaits = table;
+		numIoWaits = size;
+	}
+
+	if (ioWaits[fd] == NULL) {
+		struct ioWait * wait = malloc(sizeof(struct ioWait));
+		if (wait == NULL) { return NULL; }
+		wait->readers.head = NULL;
+		wait->readers.tail = NULL;
+		wait->writers.head = NULL;
+		wait->writers.tail = NULL;
+		wait->events = 0;
+		ioWaits[fd] = wait;
+	}
+	return ioWaits[fd];
+}
+
+// Parks the running thread until <fd> is ready for <events>, EPOLLIN
+// or EPOLLOUT. The scheduler must be blocked, and is unblocked when it
+// returns. Returns 0 once <fd> may be ready, or -1 and sets errno if it
+// can't be waited on with epoll.
+int waitForIo(int fd, unsigned int events) {
+
+	struct ioWait * wait = getIoWait(fd);
+	if (wait == NULL) {
+		block = 0;
+		errno = ENOMEM;
+		return -1;
 	}
 
+	if (updateIoEvents(fd, events) < 0) {
+		block = 0;
+		return -1;
+	}
+
+	numIoWaiters++;
+	waitInQueue((events == EPOLLIN) ? &(wait->readers) : &(wait->writers));
 	return 0;
+}
+
+// Sets O_NONBLOCK on <fd> for a single call so it fails with EAGAIN
+// instead of stopping the kernel thread every thread runs on. Returns
+// the flags for restoreFlags to put back, or -1 if they can't be read.
+int setNonBlocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags >= 0 && !(flags & O_NONBLOCK)) { fcntl(fd, F_SETFL, flags | O_NONBLOCK); }
+	return flags;
+}
+
+// Gives <fd> back the <flags> setNonBlocking returned, so code
+// using <fd> directly or sharing it with another process never
+// sees it non-blocking. Keeps errno.
+void restoreFlags(int fd, int flags) {
+	if (flags >= 0 && !(flags & O_NONBLOCK)) {
+		int error = errno;
+		fcntl(fd, F_SETFL, flags);
+		errno = error;
+	}
+}
+
+// Reads or writes <fd> once without blocking. Sockets are asked not
+// to block with MSG_DONTWAIT, other descriptors are made non-blocking
+// for the call. The scheduler must be blocked.
+ssize_t transferOnce(int fd, void * buf, size_t count, char writing) {
+	ssize_t ret = writing ? send(fd, buf, count, MSG_DONTWAIT) : recv(fd, buf, count, MSG_DONTWAIT);
+	if (ret >= 0 || errno != ENOTSOCK) { return ret; }
+	int flags = setNonBlocking(fd);
+	ret = writing ? write(fd, buf, count) : read(fd, buf, count);
+	restoreFlags(fd, flags);
+	return ret;
+}
+
+// Touches every page of the <count> bytes at <buf> so any of them that
+// are protected are brought in by the fault handler. The kernel doesn't
+// fault on protected pages during a system call, it fails with EFAULT.
+void touchBuffer(const void * buf, size_t count) {
+	if (count == 0) { return; }
+	const volatile char * byte = buf;
+	const volatile char * end = CHAR_PTR(buf) + count - 1;
+	while (byte <= end) {
+		(void) *byte;
+		byte = (const volatile char *) ((UNSGND_LONG(byte) & ~(pageSize - 1)) + pageSize);
+	}
+	(void) *end;
+}
+
+/* read from a file descriptor without blocking other threads */
+ssize_t my_read(int fd, void *buf, size_t count) {
+
+	initializeThreads();
+
+	// Park until <fd> is readable whenever it has nothing to read.
+	// The scheduler is blocked so the buffer's pages stay in.
+	while (1) {
+		block = 1;
+		touchBuffer(buf, count);
+		ssize_t ret = transferOnce(fd, buf, count, 0);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			block = 0;
+			return ret;
+		}
+		if (waitForIo(fd, EPOLLIN) == -1) { return -1; }
+	}
 };
 
-/* destroy the mutex */
-int my_pthread_mutex_destroy(my_pthread_mutex_t *mutex) {
-	free(mutex->waiters);
+/* write to a file descriptor without blocking other threads */
+ssize_t my_write(int fd, const void *buf, size_t count) {
+
+	initializeThreads();
+
+	// Park until <fd> is writable whenever it's full
+	while (1) {
+		block = 1;
+		touchBuffer(buf, count);
+		ssize_t ret = transferOnce(fd, (void *) buf, count, 1);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			block = 0;
+			return ret;
+		}
+		if (waitForIo(fd, EPOLLOUT) == -1) { return -1; }
+	}
+};
+
+/* accept a connection on a socket without blocking other threads */
+int my_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
+
+	initializeThreads();
+
+	// Park until a connection comes in
+	while (1) {
+		block = 1;
+		if (addrlen != NULL) { touchBuffer(addrlen, sizeof(socklen_t)); }
+		if (addr != NULL && addrlen != NULL) { touchBuffer(addr, *addrlen); }
+		int flags = setNonBlocking(sockfd);
+		int ret = accept(sockfd, addr, addrlen);
+		restoreFlags(sockfd, flags);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			block = 0;
+			return ret;
+		}
+		if (waitForIo(sockfd, EPOLLIN) == -1) { return -1; }
+	}
+};
+
+/* connect a socket without blocking other threads */
+int my_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
+
+	initializeThreads();
+
+	block = 1;
+	touchBuffer(addr, addrlen);
+	int flags = setNonBlocking(sockfd);
+	int ret = connect(sockfd, addr, addrlen);
+	restoreFlags(sockfd, flags);
+	if (ret == 0 || errno != EINPROGRESS) {
+		block = 0;
+		return ret;
+	}
+
+	// Park until the connection is made or fails, which
+	// makes the socket writable, then get its result
+	if (waitForIo(sockfd, EPOLLOUT) == -1) { return -1; }
+	int error = 0;
+	socklen_t length = sizeof(error);
+	if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) { return -1; }
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
 	return 0;
 };
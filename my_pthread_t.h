@@ -20,40 +20,157 @@
 #include <ucontext.h>
 #include <sys/time.h>
 #include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/socket.h>
 #include "mylib.h"
 
 // typedef uint my_pthread_t;
 typedef void * my_pthread_t;
 
+// Threads are switched with a hand written context switch
+// on x86-64, other architectures fall back to ucontext
+#if defined(__x86_64__) && !defined(USE_UCONTEXT)
+#define FAST_SWITCH
+#endif
+
+// Intrusive queue of tcbs linked through their
+// next and previous fields
+struct queue {
+	struct threadControlBlock * head;
+	struct threadControlBlock * tail;
+};
+
 typedef struct threadControlBlock {
 	/* add something here */
+#ifdef FAST_SWITCH
+	void * stackPointer;
+#else
 	ucontext_t context;
+#endif
+	void * stack;
+	size_t stackSize;
+	void *(*function)(void *);
+	void * arg;
 	char done;
 	void * retVal;
-	struct threadControlBlock * waiter;
+	// Threads waiting in my_pthread_join for this thread, and the
+	// number of threads joining it, the last to leave frees it
+	struct queue joiners;
+	unsigned int numJoiners;
 	int priorityLevel;
 	struct timeval start;
+	// Time the thread last became runnable
+	struct timeval readyTime;
+	// Run time in microseconds weighted by the thread's nice
+	// value, the fair scheduler runs the lowest first
+	unsigned long long vruntime;
+	int nice;
+	unsigned int weight;
+	// First child in the fair scheduler's pairing heap, the
+	// next and previous fields link the siblings
+	struct threadControlBlock * child;
+	// Number of pages the thread owns in the page table, and the
+	// page table rows holding them linked through their owner links
+	size_t numPages;
+	struct pageTableRow * pages;
+	// Bitmap of the memory pages holding the thread's page of
+	// the same number, these are the pages it can access
+	unsigned long * residentPages;
+	// Magazines of freed small shared blocks kept for reuse
+	struct sharedCache * sharedCache;
+	// Intrusive links for the queue the thread is in
+	struct threadControlBlock * next;
+	struct threadControlBlock * previous;
+	struct queue * queue;
+	// Tick of the timer wheel to wake the thread at when it waits
+	// with a deadline, and its links in the wheel's slot
+	unsigned long long wakeTick;
+	struct threadControlBlock * timerNext;
+	struct threadControlBlock * timerPrevious;
+	struct threadControlBlock ** timerSlot;
+	// Set when the thread was woken because its deadline passed
+	char timedOut;
 } tcb; 
 
+/* define your data structures here: */
+
 /* mutex struct definition */
 typedef struct my_pthread_mutex_t {
 	/* add something here */
-	char guard;
 	tcb * locker;
-	struct queue * waiters;
+	struct queue waiters;
+
+	// Contention counters, the number of times the mutex was
+	// acquired, how many of those found it locked, and how many
+	// times a thread was parked waiting for it
+	unsigned long acquisitions;
+	unsigned long contentions;
+	unsigned long waits;
 } my_pthread_mutex_t;
 
-/* define your data structures here: */
+// Reader-writer lock held by either <readers> threads or <writer>.
+// Waiting writers are preferred, readers that come while a writer
+// holds or waits for the lock are parked until no writer is left.
+typedef struct my_pthread_rwlock_t {
+	unsigned int readers;
+	tcb * writer;
+	unsigned int waitingWriters;
+	struct queue readWaiters;
+	struct queue writeWaiters;
+
+	// Contention counters like the mutex's for each side
+	unsigned long readAcquisitions;
+	unsigned long readContentions;
+	unsigned long writeAcquisitions;
+	unsigned long writeContentions;
+} my_pthread_rwlock_t;
+
+// Condition variable, threads waiting on it are parked in waiters
+typedef struct my_pthread_cond_t {
+	struct queue waiters;
+} my_pthread_cond_t;
+
+// Counting semaphore. Threads waiting for value to be
+// above 0 are parked in waiters and posts hand the unit
+// straight to the longest waiting thread.
+typedef struct my_sem_t {
+	unsigned int value;
+	struct queue waiters;
+} my_sem_t;
 
-struct queueNode {
-	void * data;
-	struct queueNode * next;
-	struct queueNode * previous;
+// Barrier for count threads, the ones that
+// arrived so far are parked in waiters
+typedef struct my_pthread_barrier_t {
+	unsigned int count;
+	unsigned int waiting;
+	struct queue waiters;
+} my_pthread_barrier_t;
+
+// Number of buckets in the scheduling latency histogram
+#define NUM_LATENCY_BUCKETS 32
+
+// Scheduler counters. Latencies are the microseconds from a thread
+// becoming runnable to it running. Bucket 0 of <latencyHistogram>
+// counts latencies under 1 and bucket i > 0 counts the ones from
+// 2^(i-1) up to 2^i, with the last bucket taking everything above.
+struct schedulerStats {
+	char fair;
+	unsigned long switches;
+	unsigned long latencyHistogram[NUM_LATENCY_BUCKETS];
+	unsigned long long totalLatency;
+	unsigned long maxLatency;
+	// Upper bounds of the buckets holding the 50th and 99th
+	// percentile latencies, capped at <maxLatency>
+	unsigned long p50Latency;
+	unsigned long p99Latency;
 };
 
-struct queue {
-	struct queueNode * head;
-	struct queueNode * tail;
+// Header of a freed thread stack, stored at the
+// bottom of the stack while it waits in the pool
+struct pooledStack {
+	struct pooledStack * next;
+	size_t size;
 };
 
 struct priorityQueue {
@@ -61,6 +178,14 @@ struct priorityQueue {
 	unsigned int timeSlice;
 };
 
+// Threads waiting for a file descriptor to be ready, and
+// the epoll events the descriptor is registered for
+struct ioWait {
+	struct queue readers;
+	struct queue writers;
+	unsigned int events;
+};
+
 // Feel free to add your own auxiliary data structures
 
 
@@ -78,18 +203,111 @@ void my_pthread_exit(void *value_ptr);
 /* wait for thread termination */
 int my_pthread_join(my_pthread_t thread, void **value_ptr);
 
+/* wait for thread termination until an absolute time */
+int my_pthread_timedjoin(my_pthread_t thread, void **value_ptr, const struct timespec *abstime);
+
+/* suspend the calling thread for a number of microseconds */
+int my_pthread_sleep(useconds_t microseconds);
+
+/* set the nice value of a thread for the fair scheduler */
+int my_pthread_setnice(my_pthread_t thread, int nice);
+
+/* get the nice value of a thread */
+int my_pthread_getnice(my_pthread_t thread);
+
+/* get the scheduler counters */
+void getSchedulerStats(struct schedulerStats * stats);
+
+/* read from a file descriptor without blocking other threads */
+ssize_t my_read(int fd, void *buf, size_t count);
+
+/* write to a file descriptor without blocking other threads */
+ssize_t my_write(int fd, const void *buf, size_t count);
+
+/* accept a connection on a socket without blocking other threads */
+int my_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+
+/* connect a socket without blocking other threads */
+int my_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+
 /* initial the mutex lock */
 int my_pthread_mutex_init(my_pthread_mutex_t *mutex, const pthread_mutexattr_t *mutexattr);
 
 /* aquire the mutex lock */
 int my_pthread_mutex_lock(my_pthread_mutex_t *mutex);
 
+/* aquire the mutex lock, waiting no later than an absolute time */
+int my_pthread_mutex_timedlock(my_pthread_mutex_t *mutex, const struct timespec *abstime);
+
 /* release the mutex lock */
 int my_pthread_mutex_unlock(my_pthread_mutex_t *mutex);
 
 /* destroy the mutex */
 int my_pthread_mutex_destroy(my_pthread_mutex_t *mutex);
 
+/* initial the reader-writer lock */
+int my_pthread_rwlock_init(my_pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *rwlockattr);
+
+/* aquire the reader-writer lock for reading */
+int my_pthread_rwlock_rdlock(my_pthread_rwlock_t *rwlock);
+
+/* aquire the reader-writer lock for reading if it can be done without waiting */
+int my_pthread_rwlock_tryrdlock(my_pthread_rwlock_t *rwlock);
+
+/* aquire the reader-writer lock for writing */
+int my_pthread_rwlock_wrlock(my_pthread_rwlock_t *rwlock);
+
+/* aquire the reader-writer lock for writing if it can be done without waiting */
+int my_pthread_rwlock_trywrlock(my_pthread_rwlock_t *rwlock);
+
+/* release the reader-writer lock */
+int my_pthread_rwlock_unlock(my_pthread_rwlock_t *rwlock);
+
+/* destroy the reader-writer lock */
+int my_pthread_rwlock_destroy(my_pthread_rwlock_t *rwlock);
+
+/* initial the condition variable */
+int my_pthread_cond_init(my_pthread_cond_t *cond, const pthread_condattr_t *condattr);
+
+/* release the mutex and wait for the condition variable to be signaled */
+int my_pthread_cond_wait(my_pthread_cond_t *cond, my_pthread_mutex_t *mutex);
+
+/* wake one thread waiting on the condition variable */
+int my_pthread_cond_signal(my_pthread_cond_t *cond);
+
+/* wake all threads waiting on the condition variable */
+int my_pthread_cond_broadcast(my_pthread_cond_t *cond);
+
+/* destroy the condition variable */
+int my_pthread_cond_destroy(my_pthread_cond_t *cond);
+
+/* initial the semaphore */
+int my_sem_init(my_sem_t *sem, int pshared, unsigned int value);
+
+/* wait for the semaphore to be above 0 and decrement it */
+int my_sem_wait(my_sem_t *sem);
+
+/* decrement the semaphore if it's above 0 without waiting */
+int my_sem_trywait(my_sem_t *sem);
+
+/* increment the semaphore */
+int my_sem_post(my_sem_t *sem);
+
+/* get the value of the semaphore */
+int my_sem_getvalue(my_sem_t *sem, int *value);
+
+/* destroy the semaphore */
+int my_sem_destroy(my_sem_t *sem);
+
+/* initial the barrier */
+int my_pthread_barrier_init(my_pthread_barrier_t *barrier, const pthread_barrierattr_t *barrierattr, unsigned int count);
+
+/* wait for all threads to reach the barrier */
+int my_pthread_barrier_wait(my_pthread_barrier_t *barrier);
+
+/* destroy the barrier */
+int my_pthread_barrier_destroy(my_pthread_barrier_t *barrier);
+
 #endif
 
 #define USE_MY_PTHREAD 1 (comment it if you want to use real pthread)
@@ -100,8 +318,35 @@ int my_pthread_mutex_destroy(my_pthread_mutex_t *mutex);
 #define pthread_create my_pthread_create
 #define pthread_exit my_pthread_exit
 #define pthread_join my_pthread_join
+#define pthread_timedjoin_np my_pthread_timedjoin
 #define pthread_mutex_init my_pthread_mutex_init
 #define pthread_mutex_lock my_pthread_mutex_lock
+#define pthread_mutex_timedlock my_pthread_mutex_timedlock
 #define pthread_mutex_unlock my_pthread_mutex_unlock
 #define pthread_mutex_destroy my_pthread_mutex_destroy
+#define pthread_rwlock_t my_pthread_rwlock_t
+#define pthread_rwlock_init my_pthread_rwlock_init
+#define pthread_rwlock_rdlock my_pthread_rwlock_rdlock
+#define pthread_rwlock_tryrdlock my_pthread_rwlock_tryrdlock
+#define pthread_rwlock_wrlock my_pthread_rwlock_wrlock
+#define pthread_rwlock_trywrlock my_pthread_rwlock_trywrlock
+#define pthread_rwlock_unlock my_pthread_rwlock_unlock
+#define pthread_rwlock_destroy my_pthread_rwlock_destroy
+#define pthread_cond_t my_pthread_cond_t
+#define pthread_cond_init my_pthread_cond_init
+#define pthread_cond_wait my_pthread_cond_wait
+#define pthread_cond_signal my_pthread_cond_signal
+#define pthread_cond_broadcast my_pthread_cond_broadcast
+#define pthread_cond_destroy my_pthread_cond_destroy
+#define sem_t my_sem_t
+#define sem_init my_sem_init
+#define sem_wait my_sem_wait
+#define sem_trywait my_sem_trywait
+#define sem_post my_sem_post
+#define sem_getvalue my_sem_getvalue
+#define sem_destroy my_sem_destroy
+#define pthread_barrier_t my_pthread_barrier_t
+#define pthread_barrier_init my_pthread_barrier_init
+#define pthread_barrier_wait my_pthread_barrier_wait
+#define pthread_barrier_destroy my_pthread_barrier_destroy
 #endif
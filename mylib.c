@@ -1,10 +1,22 @@
+#define _GNU_SOURCE
 #include <malloc.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <linux/userfaultfd.h>
 #include "my_pthread_t.h"
 
+// The userfaultfd handler runs on a kernel thread
+#undef pthread_t
+#undef pthread_create
+
 // Size macros
 #define MEM_SIZE (8 * 1000 * 1000)
 #define SWAP_SIZE (MEM_SIZE * 2)
@@ -15,6 +27,7 @@
 #define BLK_SIZE(payloadSize) (payloadSize + DBL_BLK_META_SIZE)
 #define PG_TBL_ROW_SIZE sizeof(struct pageTableRow)
 #define THRD_META_SIZE sizeof(struct threadMemoryMetadata)
+#define MIN_PAYLOAD_SIZE sizeof(struct freeLinks)
 
 // Casting macros
 #define VOID_PTR(x) ((void *) (x))
@@ -24,6 +37,7 @@
 #define PAGE_META_PTR(x) ((struct pageMetadata *) (x))
 #define PG_TBL_ROW_PTR(x) ((struct pageTableRow *) (x))
 #define THRD_META_PTR(x) ((struct threadMemoryMetadata *) (x))
+#define FREE_LINKS_PTR(head) ((struct freeLinks *) ((head) + 1))
 #define UNSGND_LONG(x) ((unsigned long) (x))
 
 // Direct access macros
@@ -36,11 +50,136 @@
 #define MEM_PGS CHAR_PTR(PG_TBL + NUM_PGS)
 #define THRD_MEM (THRD_META_PTR(MEM_PGS))
 #define THRD_MEM_PART (THRD_MEM->partition)
+#define THRD_MEM_END (MEM_PGS + (NUM_MEM_PGS * pageSize))
+#define PARTITION_END(partition) CHAR_PTR((partition)->lastTail + 1)
+#define RUN_HEADER_SIZE ALIGN_PAYLOAD(sizeof(struct largeRun))
+#define RUN_PTR(ptr) ((struct largeRun *) (CHAR_PTR(ptr) - RUN_HEADER_SIZE))
 #define SWAP_FILE (MEM_INFO->swapfile)
+#define FRAME_FILE (MEM_INFO->frameFile)
+#define FRAME_ALIAS (MEM_INFO->frameAlias)
+#define REMAP_PAGE_SIZE (MEM_INFO->remapPageSize)
 #define SHRD_MEM_PART (MEM_INFO->sharedMemory)
+#define SHRD_ARENAS (MEM_INFO->sharedArenas)
+#define SHRD_DEPOTS (MEM_INFO->sharedDepots)
+#define HEAP_PROFILE (MEM_INFO->heapProfile)
+#define PG_BUCKETS (MEM_INFO->pageBuckets)
+#define NUM_PG_BUCKETS (MEM_INFO->numPageBuckets)
+#define FREE_MEM_PGS (MEM_INFO->freeMemPages)
+#define FREE_SWAP_PGS (MEM_INFO->freeSwapPages)
+#define NUM_USED_PGS (MEM_INFO->numUsedPages)
+#define CLOCK_HAND (MEM_INFO->clockHand)
+#define STATS (MEM_INFO->stats)
+#define SWAP_WRITE_BUF (MEM_INFO->swapWriteBuffer)
+#define SWAP_MAP (MEM_INFO->swapMap)
+#define CMPRS_MEM_PART (MEM_INFO->compressedMemory)
+#define USER_FAULT_FILE (MEM_INFO->userFaultFile)
+#define RESOLVING_FAULT (MEM_INFO->resolvingUserFault)
+#define CMPRS_TABLE (MEM_INFO->compressTable)
+#define CMPRS_BUF (MEM_INFO->compressBuffer)
+#define CMPRS_DISABLED (MEM_INFO->compressionDisabled)
+#define PENDING_WRITES (MEM_INFO->pendingWrites)
+#define NUM_PENDING_WRITES (MEM_INFO->numPendingWrites)
 
 // Shorthand macros
 #define COPY_PAGE(dest, page) memcpy(dest, page, pageSize)
+#define ALIGN_PAYLOAD(size) (((size) + BLK_META_SIZE - 1) & ~(BLK_META_SIZE - 1))
+#define ALIGN_PAGE(x) (((x) + pageSize - 1) & ~(pageSize - 1))
+#define ALIGN_UP(x, alignment) (((x) + (alignment) - 1) & ~((alignment) - 1))
+#define BITS_PER_WORD (sizeof(unsigned long) * 8)
+#define RESIDENT_PGS_SIZE (((NUM_MEM_PGS + BITS_PER_WORD - 1) / BITS_PER_WORD) * sizeof(unsigned long))
+#define HASH_PAGE(thread, pageNumber) (((UNSGND_LONG(thread) >> 4) + ((pageNumber) * 2654435761UL)) & (NUM_PG_BUCKETS - 1))
+
+// Number of segregated free lists in a partition. Free list i
+// holds free blocks with payloads in [2^(i+4), 2^(i+5)) bytes
+// except the last one which holds everything bigger.
+#define NUM_SIZE_CLASSES 24
+// Number of blocks looked at in each free list when allocating
+#define NUM_FIT_CANDIDATES 8
+
+// Memory pages are swapped by remapping frames of a memory file
+// when pages are at least this big. With 4 KB pages copying is
+// faster since every remap splits the mapping and flushes the TLB.
+#define MIN_REMAP_PAGE_SIZE (16 * 1024)
+// Environment variable replacing MIN_REMAP_PAGE_SIZE with its number
+// of bytes, so remapping can be used and tested with small pages
+#define REMAP_SIZE_ENV "MYLIB_REMAP_PAGE_SIZE"
+
+// Thread allocations of at least this many bytes get a run of
+// pages of their own from the top of the thread's pages instead
+// of a block in the thread's partition. Freeing a run raises the
+// thread's threshold to the run's size, up to the max, so a thread
+// that keeps freeing and reallocating the same size stops releasing
+// and refaulting its pages every time.
+#define LARGE_ALLOC_SIZE (pageSize * 16)
+#define MAX_LARGE_ALLOC_SIZE (pageSize * 256)
+
+// When the shared memory partition runs out, shared memory grows by
+// arenas of at least this many bytes from the library's partition
+#define SHRD_ARENA_SIZE (pageSize * 16)
+
+// Each thread keeps magazines of up to MAGAZINE_SIZE freed shared
+// blocks for every payload size up to MAX_CACHED_SIZE so small
+// shared allocations and frees don't go to the shared partitions.
+// Threads trade full and empty magazines with a depot per size,
+// which sends the blocks of any magazines past MAX_DEPOT_MAGAZINES
+// back to their partitions.
+#define MAGAZINE_SIZE 16
+#define MAX_CACHED_SIZE 256
+#define NUM_CACHED_SIZES ((int) (MAX_CACHED_SIZE / BLK_META_SIZE))
+#define MAX_DEPOT_MAGAZINES 8
+
+// Freeing a thread's memory gives back the whole pages at the end
+// of its partition when there are at least this many free there.
+// Each thread's threshold grows past the most pages it gave back
+// so a thread repeatedly freeing and reallocating the same big
+// block doesn't keep faulting its pages back in.
+#define TRIM_THRESHOLD_PAGES 4
+
+// Number of pages written to swapFile that are buffered before
+// being written out. Buffered pages going to contiguous pages
+// of swapFile are written with a single call.
+#define SWAP_WRITE_BATCH 16
+
+// Environment variable selecting how swapFile is accessed. Setting
+// it to "mmap" maps swapFile into memory so pages are moved in and
+// out of it with memcpy and the kernel writes them back. Otherwise
+// swapFile is read and written explicitly.
+#define SWAP_MODE_ENV "MYLIB_SWAP_MODE"
+
+// Environment variable selecting how faults on memory pages are
+// caught. Setting it to "userfaultfd" resolves them on a kernel
+// thread reading userfaultfd, with pages made inaccessible by
+// unmapping them. Otherwise pages are mprotected and faults are
+// resolved in a SIGSEGV handler.
+#define FAULT_MODE_ENV "MYLIB_FAULT_MODE"
+
+// Environment variable turning on the heap profiler. It's set to the
+// average number of bytes allocated by threads between sampled
+// allocations, or 0 to record every allocation. The profile is
+// written to stderr at exit and when the program gets SIGUSR1.
+#define HEAP_PROFILE_ENV "MYLIB_HEAP_PROFILE"
+#define NUM_SITE_BUCKETS 256
+#define NUM_SAMPLE_BUCKETS 1024
+
+// Pages leaving memory for swapFile are first compressed into a pool
+// of this many bytes taken from the library's memory the first time
+// a page leaves. Pages only go to swapFile if the pool is full, it
+// couldn't be allocated, or they compress to more than
+// MAX_COMPRESSED_SIZE bytes.
+#define COMPRESSED_POOL_SIZE (1024 * 1024)
+#define MAX_COMPRESSED_SIZE ((pageSize * 3) / 4)
+
+// Compression codec settings. Compressed pages are a sequence of
+// tokens. A token below 128 is followed by that many plus one
+// literal bytes. Any other token is a copy of the token minus 128
+// plus MIN_MATCH bytes from the distance back given by the next 2
+// bytes. Matches are found through a hash table of positions.
+#define MIN_MATCH 4
+#define MAX_MATCH (127 + MIN_MATCH)
+#define MAX_LITERALS 128
+#define MAX_MATCH_DISTANCE 0xFFFF
+#define NUM_CMPRS_BUCKETS 4096
+#define MATCH_SKIP_SHIFT 5
 
 // These macros determine how much of memory should
 // be partitioned for the thread library vs threads
@@ -54,23 +193,131 @@ struct blockMetadata {
     size_t payloadSize;
 };
 
-// Holds info for a partition in memory
+// Links stored at the start of a free block's payload
+// to chain it into its partition's free list
+struct freeLinks {
+    struct blockMetadata * next;
+    struct blockMetadata * previous;
+};
+
+// Holds info for a partition in memory. The free bytes and blocks
+// are kept up to date by the free lists.
 struct memoryPartition {
     struct blockMetadata * firstHead;
     struct blockMetadata * lastTail;
+    struct blockMetadata * freeLists[NUM_SIZE_CLASSES];
+    size_t freeBytes;
+    size_t numFreeBlocks;
+    unsigned long allocations;
+    unsigned long deallocations;
 };
 
-// Repressents a row in the page table
+// Repressents a row in the page table. Used rows are chained
+// in their page hash bucket and free rows in their free list.
 struct pageTableRow {
     tcb * thread;
     unsigned long pageNumber;
     void * physicalLocation;
     off_t virtualLocation;
+    off_t frameOffset;
+    void * compressedLocation;
+    size_t compressedSize;
+    char referenced;
+    struct pageTableRow * next;
+    struct pageTableRow * previous;
+    // Links in the list of rows owned by the same thread
+    struct pageTableRow * ownerNext;
+    struct pageTableRow * ownerPrevious;
+};
+
+// An arena of shared memory added when the shared memory partition
+// runs out. Its partition follows it in the same library block.
+struct sharedArena {
+    struct memoryPartition partition;
+    struct sharedArena * next;
+};
+
+// Header at the start of the run of pages of a large allocation.
+// A thread's runs are chained in order of address.
+struct largeRun {
+    size_t numPages;
+    struct largeRun * next;
+    struct largeRun * previous;
+};
+
+// A stack of freed shared blocks of the same payload size. The
+// blocks stay used in their partitions while they're cached.
+struct magazine {
+    int numBlocks;
+    struct magazine * next;
+    void * blocks[MAGAZINE_SIZE];
+};
+
+// Full and empty magazines for a payload size shared by all threads
+struct magazineDepot {
+    struct magazine * full;
+    struct magazine * empty;
+    int numFull;
+};
+
+// A thread's magazines for each payload size. Blocks are taken from
+// and freed to loaded, and previous is swapped in when loaded runs
+// out so a thread going back and forth at the edge of a magazine
+// doesn't trade with the depot every time.
+struct sharedCache {
+    struct magazine * loaded[NUM_CACHED_SIZES];
+    struct magazine * previous[NUM_CACHED_SIZES];
+};
+
+// Estimated allocations made at a call site of the allocating functions
+struct callSite {
+    char * fileName;
+    int lineNumber;
+    size_t liveBytes;
+    size_t peakBytes;
+    size_t allocatedBytes;
+    size_t allocations;
+    struct callSite * next;
+};
+
+// Estimated live allocations of a running thread
+struct threadProfile {
+    tcb * thread;
+    size_t liveBytes;
+    size_t peakBytes;
+    size_t allocations;
+    struct threadProfile * next;
+};
+
+// A sampled allocation still in use. It stands for bytes
+// bytes of allocations from site by thread.
+struct heapSample {
+    void * ptr;
+    size_t bytes;
+    struct callSite * site;
+    struct threadProfile * thread;
+    struct heapSample * next;
+};
+
+// Heap profiler state. A sample is taken when the bytes allocated
+// since the last one pass bytesUntilSample, which is picked at random
+// each time so allocation patterns can't line up with the samples.
+struct heapProfile {
+    size_t sampleInterval;
+    long bytesUntilSample;
+    unsigned long randomState;
+    volatile sig_atomic_t dumpRequested;
+    struct callSite * sites[NUM_SITE_BUCKETS];
+    struct heapSample * samples[NUM_SAMPLE_BUCKETS];
+    struct threadProfile * threads;
 };
 
 // Metadata for thread's memory
 struct threadMemoryMetadata {
     struct memoryPartition partition;
+    size_t trimThresholdPages;
+    struct largeRun * runs;
+    size_t largeAllocSize;
 };
 
 // Metadata for memory
@@ -80,7 +327,30 @@ struct memoryMetadata {
     size_t numMemPages;
     size_t numSwapPages;
     int swapfile;
+    int frameFile;
+    char * frameAlias;
+    long remapPageSize;
     struct memoryPartition sharedMemory;
+    struct pageTableRow ** pageBuckets;
+    unsigned long numPageBuckets;
+    struct pageTableRow * freeMemPages;
+    struct pageTableRow * freeSwapPages;
+    size_t numUsedPages;
+    size_t clockHand;
+    struct memoryStats stats;
+    char * swapWriteBuffer;
+    char * swapMap;
+    struct memoryPartition compressedMemory;
+    unsigned int * compressTable;
+    unsigned char * compressBuffer;
+    char compressionDisabled;
+    off_t pendingWrites[SWAP_WRITE_BATCH];
+    int numPendingWrites;
+    int userFaultFile;
+    char resolvingUserFault;
+    struct sharedArena * sharedArenas;
+    struct magazineDepot sharedDepots[NUM_CACHED_SIZES];
+    struct heapProfile * heapProfile;
 };
 
 // "Main memory"
@@ -96,48 +366,134 @@ extern tcb * currentTcb;
 // Used to initialize the thread library
 void initializeThreads(void);
 
-// Seeks swapFile and exits on error
-void seekSwapFile(off_t offset) {
-    if (lseek(SWAP_FILE, offset, SEEK_SET) == ((off_t) -1)) {
-        fprintf(stderr, "Error seeking swapFile: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+// Writes every buffered page to swapFile, sorted by their
+// offsets so pages going to contiguous pages of swapFile are
+// written with one call. Exits on error.
+void flushSwapWrites() {
+    int order[SWAP_WRITE_BATCH];
+    int i, j;
+    for (i = 0; i < NUM_PENDING_WRITES; i++) {
+        for (j = i; j > 0 && PENDING_WRITES[order[j - 1]] > PENDING_WRITES[i]; j--) { order[j] = order[j - 1]; }
+        order[j] = i;
+    }
+    struct iovec pages[SWAP_WRITE_BATCH];
+    for (i = 0; i < NUM_PENDING_WRITES; i += j) {
+        j = 0;
+        do {
+            pages[j].iov_base = SWAP_WRITE_BUF + (order[i + j] * pageSize);
+            pages[j].iov_len = pageSize;
+            j++;
+        } while (i + j < NUM_PENDING_WRITES && PENDING_WRITES[order[i + j]] == PENDING_WRITES[order[i + j - 1]] + pageSize);
+        STATS.swapFileWrites++;
+        if (pwritev(SWAP_FILE, pages, j, PENDING_WRITES[order[i]]) == -1) {
+            fprintf(stderr, "Error writing to swapFile: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    NUM_PENDING_WRITES = 0;
+}
+
+// Returns the buffered page waiting to be written
+// at offset of swapFile or NULL if there isn't one
+char * findSwapWrite(off_t offset) {
+    int i;
+    for (i = 0; i < NUM_PENDING_WRITES; i++) {
+        if (PENDING_WRITES[i] == offset) { return SWAP_WRITE_BUF + (i * pageSize); }
     }
+    return NULL;
 }
 
-// Reads a page from swapFile at the current seeked
-// position and stores it into buf. Exits on error.
-void readSwapFilePage(void * buf) {
-    if (read(SWAP_FILE, buf, pageSize) == -1) {
+// Reads the page at offset of swapFile into buf, taking
+// it from swapFile's mapping if it's mapped or from the
+// write buffer if it's still waiting to be written.
+// Exits on error.
+void readSwapFilePage(void * buf, off_t offset) {
+    STATS.swapIns++;
+    if (SWAP_MAP) {
+        COPY_PAGE(buf, SWAP_MAP + offset);
+        return;
+    }
+    char * pending = findSwapWrite(offset);
+    if (pending) {
+        COPY_PAGE(buf, pending);
+    } else if (pread(SWAP_FILE, buf, pageSize, offset) == -1) {
         fprintf(stderr, "Error reading from swapFile: %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
 }
 
-// Writes a page from buf into swapFile at the
-// current seeked position. Exits on error.
-void writeSwapFilePage(void * buf) {
-    if (write(SWAP_FILE, buf, pageSize) == -1) {
-        fprintf(stderr, "Error writing to swapFile: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+// Copies buf into swapFile's mapping at offset if it's
+// mapped. Otherwise buffers buf to be written at offset
+// of swapFile, flushing the buffer first if it's full.
+void writeSwapFilePage(void * buf, off_t offset) {
+    STATS.swapOuts++;
+    if (SWAP_MAP) {
+        COPY_PAGE(SWAP_MAP + offset, buf);
+        return;
+    }
+    char * pending = findSwapWrite(offset);
+    if (!pending) {
+        if (NUM_PENDING_WRITES == SWAP_WRITE_BATCH) { flushSwapWrites(); }
+        PENDING_WRITES[NUM_PENDING_WRITES] = offset;
+        pending = SWAP_WRITE_BUF + (NUM_PENDING_WRITES * pageSize);
+        NUM_PENDING_WRITES++;
     }
+    COPY_PAGE(pending, buf);
 }
 
-// Protects numPages pages starting at startPage and exits on error
+// Protects numPages pages starting at startPage and exits on error.
+// With userfaultfd the pages are unmapped from their frames instead.
 void protectPages(void * startPage, size_t numPages) {
-    if (mprotect(startPage, numPages * pageSize, PROT_NONE) == -1) {
+    int error;
+    if (USER_FAULT_FILE != -1) { error = madvise(startPage, numPages * pageSize, MADV_DONTNEED); }
+    else { error = mprotect(startPage, numPages * pageSize, PROT_NONE); }
+    if (error == -1) {
         fprintf(stderr, "Error protecting %ld pages starting at %p: %s\n", numPages, startPage, strerror(errno));
         exit(EXIT_FAILURE);
     }
 }
 
+// Maps numPages pages starting at startPage back to their
+// frames with userfaultfd, skipping pages already mapped.
+// A thread faulting on the pages isn't woken since its
+// fault may not be fully resolved yet. Returns -1 on error.
+int continuePages(void * startPage, size_t numPages) {
+    struct uffdio_continue request;
+    request.range.start = UNSGND_LONG(startPage);
+    request.range.len = numPages * pageSize;
+    request.mode = UFFDIO_CONTINUE_MODE_DONTWAKE;
+    while (ioctl(USER_FAULT_FILE, UFFDIO_CONTINUE, &request) == -1) {
+        unsigned long mapped = request.mapped > 0 ? request.mapped : 0;
+        if (errno == EEXIST) { mapped += pageSize; }
+        else if (errno != EAGAIN) { return -1; }
+        request.range.start += mapped;
+        request.range.len -= mapped;
+        if (!request.range.len) { break; }
+    }
+    return 0;
+}
+
 // Unprotects numPages pages starting at startPage and exits on error
 void unprotectPages(void * startPage, size_t numPages) {
-    if (mprotect(startPage, numPages * pageSize, PROT_READ|PROT_WRITE|PROT_EXEC) == -1) {
+    int error;
+    if (USER_FAULT_FILE != -1) { error = continuePages(startPage, numPages); }
+    else { error = mprotect(startPage, numPages * pageSize, PROT_READ|PROT_WRITE|PROT_EXEC); }
+    if (error == -1) {
         fprintf(stderr, "Error unprotecting %ld pages starting at %p: %s\n", numPages, startPage, strerror(errno));
         exit(EXIT_FAILURE);
     }
 }
 
+// Maps the page of frameFile at frameOffset at the memory page at
+// location, unprotected if accessible is set. Exits on error.
+void mapFrame(void * location, off_t frameOffset, int accessible) {
+    int protection = accessible ? PROT_READ|PROT_WRITE|PROT_EXEC : PROT_NONE;
+    if (mmap(location, pageSize, protection, MAP_SHARED|MAP_FIXED, FRAME_FILE, frameOffset) == MAP_FAILED) {
+        fprintf(stderr, "Error mapping frame %ld at %p: %s\n", frameOffset, location, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
 // Returns the tail of a block whose initialized head is given
 struct blockMetadata * getTail(struct blockMetadata * head) {
     return BLK_META_PTR(CHAR_PTR(head) + BLK_META_SIZE + head->payloadSize);
@@ -170,14 +526,50 @@ void setBlockMetadata(void * block, int used, size_t payloadSize) {
     *getTail(head) = *head;
 }
 
-// Creates a size bytes partition starting at ptr and returns it
-struct memoryPartition createPartition(void * ptr, size_t size) {
-    size_t payloadSize = size - DBL_BLK_META_SIZE;
+// Returns the index of the free list holding blocks of payloadSize
+int getSizeClass(size_t payloadSize) {
+    int sizeClass = (63 - __builtin_clzl(payloadSize)) - 4;
+    if (sizeClass >= NUM_SIZE_CLASSES) { return NUM_SIZE_CLASSES - 1; }
+    return sizeClass;
+}
+
+// Adds the free block starting at head to partition's free lists
+void insertFreeBlock(struct blockMetadata * head, struct memoryPartition * partition) {
+    struct blockMetadata ** list = partition->freeLists + getSizeClass(head->payloadSize);
+    FREE_LINKS_PTR(head)->previous = NULL;
+    FREE_LINKS_PTR(head)->next = *list;
+    if (*list) { FREE_LINKS_PTR(*list)->previous = head; }
+    *list = head;
+    partition->freeBytes += head->payloadSize;
+    partition->numFreeBlocks++;
+}
+
+// Removes the free block starting at head from partition's free lists
+void removeFreeBlock(struct blockMetadata * head, struct memoryPartition * partition) {
+    struct freeLinks * links = FREE_LINKS_PTR(head);
+    if (links->next) { FREE_LINKS_PTR(links->next)->previous = links->previous; }
+    if (links->previous) { FREE_LINKS_PTR(links->previous)->next = links->next; }
+    else { partition->freeLists[getSizeClass(head->payloadSize)] = links->next; }
+    partition->freeBytes -= head->payloadSize;
+    partition->numFreeBlocks--;
+}
+
+// Creates a size bytes partition starting at ptr in partition
+void createPartition(struct memoryPartition * partition, void * ptr, size_t size) {
+    char * start = CHAR_PTR(ALIGN_PAYLOAD(UNSGND_LONG(ptr)));
+    size -= start - CHAR_PTR(ptr);
+    ptr = start;
+    size_t payloadSize = (size - DBL_BLK_META_SIZE) & ~(BLK_META_SIZE - 1);
     setBlockMetadata(ptr, 0, payloadSize);
-    struct memoryPartition ret;
-    ret.firstHead = ptr;
-    ret.lastTail = getTail(ptr);
-    return ret;
+    partition->firstHead = ptr;
+    partition->lastTail = getTail(ptr);
+    int i;
+    for (i = 0; i < NUM_SIZE_CLASSES; i++) { partition->freeLists[i] = NULL; }
+    partition->freeBytes = 0;
+    partition->numFreeBlocks = 0;
+    partition->allocations = 0;
+    partition->deallocations = 0;
+    insertFreeBlock(ptr, partition);
 }
 
 // Adds size bytes to the current size of partition
@@ -186,141 +578,949 @@ void extendPartition(struct memoryPartition * partition, size_t size) {
         struct blockMetadata * newHead = partition->lastTail + 1;
         setBlockMetadata(newHead, 0, size - DBL_BLK_META_SIZE);
         partition->lastTail = getTail(newHead);
+        insertFreeBlock(newHead, partition);
     } else {
         struct blockMetadata * lastHead = getHead(partition->lastTail);
+        removeFreeBlock(lastHead, partition);
         setBlockMetadata(lastHead, 0, lastHead->payloadSize + size);
         partition->lastTail = getTail(lastHead);
+        insertFreeBlock(lastHead, partition);
+    }
+}
+
+// Returns 1 if ptr is in partition's blocks else returns 0
+int isInPartition(void * ptr, struct memoryPartition * partition) {
+    return ptr >= VOID_PTR(partition->firstHead + 1) && ptr < VOID_PTR(partition->lastTail);
+}
+
+// Allocates size bytes from partition. Returns a pointer
+// to the allocated memory or NULL if there is no space.
+void * allocateFrom(size_t size, struct memoryPartition * partition) {
+
+    // Keep payloads aligned and big enough to hold free list links
+    size = ALIGN_PAYLOAD(size);
+    if (size < MIN_PAYLOAD_SIZE) { size = MIN_PAYLOAD_SIZE; }
+
+    // Starting at the size's own free list, walks each list until a
+    // block fits and takes the lowest addressed fitting block among the
+    // first NUM_FIT_CANDIDATES blocks looked at. Preferring low addresses
+    // keeps the end of the partition free like first fit does. Only the
+    // size's own list and the last list hold blocks that can be too
+    // small, and those are walked to their end before giving up on them.
+    int sizeClass = getSizeClass(size);
+    struct blockMetadata * head = NULL;
+    for (; !head && sizeClass < NUM_SIZE_CLASSES; sizeClass++) {
+        struct blockMetadata * trav = partition->freeLists[sizeClass];
+        int i;
+        for (i = 0; trav && (!head || i < NUM_FIT_CANDIDATES); i++) {
+            if (size <= trav->payloadSize && (!head || trav < head)) { head = trav; }
+            trav = FREE_LINKS_PTR(trav)->next;
+        }
+    }
+    if (!head) { return NULL; }
+    removeFreeBlock(head, partition);
+    partition->allocations++;
+
+    // Doesn't split the found block if the rest couldn't hold a block
+    if ((size + DBL_BLK_META_SIZE + MIN_PAYLOAD_SIZE) > head->payloadSize) {
+        setBlockUsed(head, 1);
+        return head + 1;
+    }
+
+    // Splits the found block
+    size_t nextPayloadSize = head->payloadSize - (size + DBL_BLK_META_SIZE);
+    setBlockMetadata(head, 1, size);
+    struct blockMetadata * nextHead = getTail(head) + 1;
+    setBlockMetadata(nextHead, 0, nextPayloadSize);
+    insertFreeBlock(nextHead, partition);
+
+    return head + 1;
+}
+
+// Frees the used block starting at head in partition, coalescing
+// it with its neighbors if they're free
+void freeBlock(struct blockMetadata * head, struct memoryPartition * partition) {
+    struct blockMetadata * tail = getTail(head);
+
+    // Coallese with neihboring blocks, taking them off their free lists
+    if (head != partition->firstHead) {
+        struct blockMetadata * previousTail = head - 1;
+        if (previousTail->used == 0) {
+            size_t newPayloadSize = head->payloadSize + previousTail->payloadSize + DBL_BLK_META_SIZE;
+            head = getHead(previousTail);
+            removeFreeBlock(head, partition);
+            setBlockPayloadSize(head, newPayloadSize);
+        }
+    }
+    if (tail != partition->lastTail) {
+        struct blockMetadata * nextHead = tail + 1;
+        if (nextHead->used == 0) {
+            size_t newPayloadSize = tail->payloadSize + nextHead->payloadSize + DBL_BLK_META_SIZE;
+            removeFreeBlock(nextHead, partition);
+            tail = getTail(nextHead);
+            setBlockPayloadSize(head, newPayloadSize);
+        }
+    }
+
+    // Free
+    setBlockUsed(head, 0);
+    insertFreeBlock(head, partition);
+}
+
+// Deallocates ptr's block from partition. If ptr is not
+// in partition return 0, else return 1. Undefined behavior
+// if ptr isn't a pointer previously returned.
+int deallocateFrom(void * ptr, struct memoryPartition * partition) {
+    if (!isInPartition(ptr, partition)) { return 0; }
+    partition->deallocations++;
+    freeBlock(BLK_META_PTR(ptr) - 1, partition);
+    return 1;
+}
+
+// Shrinks the used block starting at head in partition to a payload
+// of payloadSize, freeing the rest if it could hold a block
+void shrinkBlock(struct blockMetadata * head, size_t payloadSize, struct memoryPartition * partition) {
+    if ((payloadSize + DBL_BLK_META_SIZE + MIN_PAYLOAD_SIZE) > head->payloadSize) { return; }
+    size_t restPayloadSize = head->payloadSize - (payloadSize + DBL_BLK_META_SIZE);
+    setBlockMetadata(head, 1, payloadSize);
+    struct blockMetadata * restHead = getTail(head) + 1;
+    setBlockMetadata(restHead, 1, restPayloadSize);
+    freeBlock(restHead, partition);
+}
+
+// Resizes ptr's block in partition to hold size bytes without
+// moving it, growing into the next block if it's free and big
+// enough. Returns 0 if it can't be resized else returns 1.
+int resizeIn(void * ptr, size_t size, struct memoryPartition * partition) {
+    size = ALIGN_PAYLOAD(size);
+    if (size < MIN_PAYLOAD_SIZE) { size = MIN_PAYLOAD_SIZE; }
+    struct blockMetadata * head = BLK_META_PTR(ptr) - 1;
+    if (size > head->payloadSize) {
+        struct blockMetadata * tail = getTail(head);
+        if (tail == partition->lastTail || (tail + 1)->used) { return 0; }
+        struct blockMetadata * nextHead = tail + 1;
+        size_t grownPayloadSize = head->payloadSize + DBL_BLK_META_SIZE + nextHead->payloadSize;
+        if (grownPayloadSize < size) { return 0; }
+        removeFreeBlock(nextHead, partition);
+        setBlockMetadata(head, 1, grownPayloadSize);
+    }
+    shrinkBlock(head, size, partition);
+    return 1;
+}
+
+// Allocates size bytes from partition with the payload aligned to
+// alignment, a power of two. The payload is moved up from where
+// allocateFrom() puts it far enough to leave a free block before it.
+// Returns NULL if there is no space.
+void * allocateAlignedFrom(size_t size, size_t alignment, struct memoryPartition * partition) {
+    if (alignment <= BLK_META_SIZE) { return allocateFrom(size, partition); }
+    size = ALIGN_PAYLOAD(size);
+    if (size < MIN_PAYLOAD_SIZE) { size = MIN_PAYLOAD_SIZE; }
+    char * ptr = allocateFrom(size + alignment + BLK_SIZE(MIN_PAYLOAD_SIZE), partition);
+    if (!ptr) { return NULL; }
+    char * aligned = CHAR_PTR(ALIGN_UP(UNSGND_LONG(ptr), alignment));
+    if (aligned != ptr) {
+        while ((size_t) (aligned - ptr) < BLK_SIZE(MIN_PAYLOAD_SIZE)) { aligned += alignment; }
+        struct blockMetadata * head = BLK_META_PTR(ptr) - 1;
+        size_t payloadSize = head->payloadSize;
+        setBlockMetadata(head, 1, aligned - ptr - DBL_BLK_META_SIZE);
+        setBlockMetadata(BLK_META_PTR(aligned) - 1, 1, payloadSize - (aligned - ptr));
+        freeBlock(head, partition);
     }
+    shrinkBlock(BLK_META_PTR(aligned) - 1, size, partition);
+    return aligned;
+}
+
+// Calls changeProtection once for every run of contiguous memory
+// pages in thread's resident pages, marking them referenced if
+// reference is set
+void forEachResidentRun(tcb * thread, void (* changeProtection)(void *, size_t), int reference) {
+    if (!thread->residentPages) { return; }
+    size_t runStart = 0;
+    size_t runLength = 0;
+    size_t word;
+    for (word = 0; word < RESIDENT_PGS_SIZE / sizeof(unsigned long); word++) {
+        unsigned long bits = thread->residentPages[word];
+        while (bits) {
+            size_t page = (word * BITS_PER_WORD) + __builtin_ctzl(bits);
+            bits &= bits - 1;
+            if (reference) { PG_TBL[page].referenced = 1; }
+            if (runLength && page == runStart + runLength) { runLength++; }
+            else {
+                if (runLength) { changeProtection(MEM_PGS + (runStart * pageSize), runLength); }
+                runStart = page;
+                runLength = 1;
+            }
+        }
+    }
+    if (runLength) { changeProtection(MEM_PGS + (runStart * pageSize), runLength); }
 }
 
 // Protects all memory pages of the given thread
 void protectAllPages(tcb * thread) {
-    off_t i;
-    for (i = 0; i < NUM_MEM_PGS; i++) {
-        if (PG_TBL[i].thread == thread) {
-            protectPages(PG_TBL[i].physicalLocation, 1);
+    forEachResidentRun(thread, protectPages, 0);
+}
+
+// Unprotects all memory pages of the given thread. The
+// pages are marked referenced since the thread is running.
+void unprotectAllPages(tcb * thread) {
+    forEachResidentRun(thread, unprotectPages, 1);
+}
+
+// Returns 1 if row is a memory page holding the page
+// of its thread with the same number, else returns 0
+int isResident(struct pageTableRow * row) {
+    return row->thread && row->physicalLocation && row->pageNumber == (unsigned long) (row - PG_TBL);
+}
+
+// Returns 1 if row is a memory page resident for the running thread
+int isAccessible(struct pageTableRow * row) {
+    return isResident(row) && row->thread == currentTcb;
+}
+
+// Protects row's memory page unless it's accessible to the running thread
+void refreshProtection(struct pageTableRow * row) {
+    if (isAccessible(row)) { unprotectPages(row->physicalLocation, 1); }
+    else { protectPages(row->physicalLocation, 1); }
+}
+
+// Returns the list row is in, its hash
+// bucket if it's used or else its free list
+struct pageTableRow ** getPageList(struct pageTableRow * row) {
+    if (row->thread) { return PG_BUCKETS + HASH_PAGE(row->thread, row->pageNumber); }
+    else if (row->physicalLocation) { return &FREE_MEM_PGS; }
+    else { return &FREE_SWAP_PGS; }
+}
+
+// Adds row to the front of its list
+void insertPageRow(struct pageTableRow * row) {
+    struct pageTableRow ** list = getPageList(row);
+    row->previous = NULL;
+    row->next = *list;
+    if (*list) { (*list)->previous = row; }
+    *list = row;
+}
+
+// Removes row from its list
+void removePageRow(struct pageTableRow * row) {
+    if (row->next) { row->next->previous = row->previous; }
+    if (row->previous) { row->previous->next = row->next; }
+    else { *getPageList(row) = row->next; }
+}
+
+// Gives row to thread as its pageNumber, or frees
+// row if thread is NULL, keeping lists and counts
+void setPageOwner(struct pageTableRow * row, tcb * thread, unsigned long pageNumber) {
+    size_t index = row - PG_TBL;
+    removePageRow(row);
+    if (row->thread) {
+        if (isResident(row)) {
+            row->thread->residentPages[index / BITS_PER_WORD] &= ~(1UL << (index % BITS_PER_WORD));
         }
+        if (row->ownerNext) { row->ownerNext->ownerPrevious = row->ownerPrevious; }
+        if (row->ownerPrevious) { row->ownerPrevious->ownerNext = row->ownerNext; }
+        else { row->thread->pages = row->ownerNext; }
+        row->thread->numPages--;
+        NUM_USED_PGS--;
     }
+    row->thread = thread;
+    row->pageNumber = pageNumber;
+    if (thread) {
+        if (isResident(row)) {
+            thread->residentPages[index / BITS_PER_WORD] |= 1UL << (index % BITS_PER_WORD);
+        }
+        row->ownerPrevious = NULL;
+        row->ownerNext = thread->pages;
+        if (thread->pages) { thread->pages->ownerPrevious = row; }
+        thread->pages = row;
+        thread->numPages++;
+        NUM_USED_PGS++;
+    }
+    insertPageRow(row);
 }
 
-// Unprotects all memory pages of the given thread
-void unprotectAllPages(tcb * thread) {
-    off_t i;
-    for (i = 0; i < NUM_MEM_PGS; i++) {
-        if (PG_TBL[i].thread == thread) {
-            unprotectPages(PG_TBL[i].physicalLocation, 1);
+// Returns the row holding thread's pageNumber, NULL if there is none
+struct pageTableRow * findPage(tcb * thread, unsigned long pageNumber) {
+    struct pageTableRow * row = PG_BUCKETS[HASH_PAGE(thread, pageNumber)];
+    while (row && (row->thread != thread || row->pageNumber != pageNumber)) { row = row->next; }
+    return row;
+}
+
+// Returns a free row, preferring pages in memory
+// over pages in swapFile. NULL if none are free.
+struct pageTableRow * getFreePage() {
+    if (FREE_MEM_PGS) { return FREE_MEM_PGS; }
+    return FREE_SWAP_PGS;
+}
+
+// Returns where the library can read and write row's memory
+// page regardless of its protection, or its physical location
+// if there's no alias of the frame file
+void * getPageData(struct pageTableRow * row) {
+    if (FRAME_ALIAS) { return FRAME_ALIAS + row->frameOffset; }
+    return row->physicalLocation;
+}
+
+// Adds size literal bytes from src to the compressed output at
+// dest + *outSize, which can't exceed limit. Returns 0 if they
+// don't fit else returns 1.
+int emitLiterals(unsigned char * dest, size_t * outSize, size_t limit, unsigned char * src, size_t size) {
+    while (size) {
+        size_t runSize = size < MAX_LITERALS ? size : MAX_LITERALS;
+        if (*outSize + 1 + runSize > limit) { return 0; }
+        dest[(*outSize)++] = runSize - 1;
+        memcpy(dest + *outSize, src, runSize);
+        *outSize += runSize;
+        src += runSize;
+        size -= runSize;
+    }
+    return 1;
+}
+
+// Compresses size bytes of src into dest. Returns the compressed
+// size or 0 if it would be more than limit bytes.
+size_t compressPage(unsigned char * dest, size_t limit, unsigned char * src, size_t size) {
+    size_t outSize = 0;
+    size_t literalStart = 0;
+    size_t i = 0;
+    while (i + MIN_MATCH <= size) {
+
+        // Look up and replace the last position with the same next
+        // bytes. Positions left by other pages are checked like any.
+        unsigned int word;
+        memcpy(&word, src + i, MIN_MATCH);
+        unsigned int * bucket = CMPRS_TABLE + ((word * 2654435761U) >> 20) % NUM_CMPRS_BUCKETS;
+        size_t candidate = *bucket;
+        *bucket = i;
+        if (candidate >= i || i - candidate > MAX_MATCH_DISTANCE || memcmp(src + candidate, src + i, MIN_MATCH)) {
+
+            // Give up once the literals alone are over the limit and
+            // look for matches less often the longer none are found
+            if (outSize + (i - literalStart) > limit) { return 0; }
+            i += 1 + ((i - literalStart) >> MATCH_SKIP_SHIFT);
+            continue;
+        }
+
+        // Extend the match a word at a time then a byte at a time
+        // and emit it after the literals before it
+        size_t length = MIN_MATCH;
+        while (i + length + sizeof(unsigned long) <= size && length + sizeof(unsigned long) <= MAX_MATCH &&
+                !memcmp(src + candidate + length, src + i + length, sizeof(unsigned long))) {
+            length += sizeof(unsigned long);
+        }
+        while (i + length < size && length < MAX_MATCH && src[candidate + length] == src[i + length]) { length++; }
+        if (!emitLiterals(dest, &outSize, limit, src + literalStart, i - literalStart)) { return 0; }
+        if (outSize + 3 > limit) { return 0; }
+        dest[outSize++] = 128 + (length - MIN_MATCH);
+        dest[outSize++] = (i - candidate) & 0xFF;
+        dest[outSize++] = (i - candidate) >> 8;
+        i += length;
+        literalStart = i;
+    }
+    if (!emitLiterals(dest, &outSize, limit, src + literalStart, size - literalStart)) { return 0; }
+    return outSize;
+}
+
+// Decompresses size bytes of src made by compressPage() into dest
+void decompressPage(unsigned char * dest, unsigned char * src, size_t size) {
+    unsigned char * end = src + size;
+    while (src < end) {
+        unsigned char token = *(src++);
+        if (token < MAX_LITERALS) {
+            memcpy(dest, src, token + 1);
+            dest += token + 1;
+            src += token + 1;
+        } else {
+            size_t length = token - 128 + MIN_MATCH;
+            size_t distance = src[0] | (src[1] << 8);
+            src += 2;
+
+            // A match overlapping itself repeats its first distance
+            // bytes so it's copied byte by byte unless it's a run
+            if (distance >= length) {
+                memcpy(dest, dest - distance, length);
+            } else if (distance == 1) {
+                memset(dest, dest[-1], length);
+            } else {
+                size_t k;
+                for (k = 0; k < length; k++) { dest[k] = dest[k - distance]; }
+            }
+            dest += length;
         }
     }
 }
 
+// Frees row's compressed page if it has one
+void discardCompressedPage(struct pageTableRow * row) {
+    if (row->compressedLocation) {
+        deallocateFrom(row->compressedLocation, &CMPRS_MEM_PART);
+        row->compressedLocation = NULL;
+    }
+}
+
+// Copies row's page, which isn't in memory, into buf by
+// decompressing it if it's in the compressed pool or
+// else reading it from swapFile
+void readSwapPage(struct pageTableRow * row, void * buf) {
+    if (row->compressedLocation) {
+        STATS.compressedIns++;
+        decompressPage(buf, row->compressedLocation, row->compressedSize);
+    } else { readSwapFilePage(buf, row->virtualLocation); }
+}
+
+// Allocates the compressed pool and the codec's hash table and buffer
+// if they haven't been. Compression is disabled for good if they
+// can't all be allocated. Returns 1 if compression is on, else 0.
+int initializeCompression() {
+    if (CMPRS_BUF) { return 1; }
+    if (CMPRS_DISABLED) { return 0; }
+    void * compressedPool = allocateFrom(COMPRESSED_POOL_SIZE, &LIB_MEM_PART);
+    unsigned int * table = allocateFrom(NUM_CMPRS_BUCKETS * sizeof(unsigned int), &LIB_MEM_PART);
+    unsigned char * buf = allocateFrom(pageSize, &LIB_MEM_PART);
+    if (!compressedPool || !table || !buf) {
+        if (compressedPool) { deallocateFrom(compressedPool, &LIB_MEM_PART); }
+        if (table) { deallocateFrom(table, &LIB_MEM_PART); }
+        if (buf) { deallocateFrom(buf, &LIB_MEM_PART); }
+        CMPRS_DISABLED = 1;
+        return 0;
+    }
+    createPartition(&CMPRS_MEM_PART, compressedPool, COMPRESSED_POOL_SIZE);
+    memset(table, 0, NUM_CMPRS_BUCKETS * sizeof(unsigned int));
+    CMPRS_TABLE = table;
+    CMPRS_BUF = buf;
+    return 1;
+}
+
+// Stores buf as row's page, which isn't in memory. The page is
+// compressed into the compressed pool if it compresses well
+// and there's room, else it's written to swapFile.
+void writeSwapPage(struct pageTableRow * row, void * buf) {
+    discardCompressedPage(row);
+    size_t size = 0;
+    if (initializeCompression()) { size = compressPage(CMPRS_BUF, MAX_COMPRESSED_SIZE, buf, pageSize); }
+    if (size) { row->compressedLocation = allocateFrom(size, &CMPRS_MEM_PART); }
+    if (row->compressedLocation) {
+        STATS.compressedOuts++;
+        memcpy(row->compressedLocation, CMPRS_BUF, size);
+        row->compressedSize = size;
+    } else { writeSwapFilePage(buf, row->virtualLocation); }
+}
+
+// Copies row's page into buf
+void readPage(struct pageTableRow * row, void * buf) {
+    if (row->physicalLocation) {
+        COPY_PAGE(buf, getPageData(row));
+    } else {
+        readSwapPage(row, buf);
+    }
+}
+
+// Copies buf into row's page
+void writePage(struct pageTableRow * row, void * buf) {
+    if (row->physicalLocation) {
+        COPY_PAGE(getPageData(row), buf);
+    } else {
+        writeSwapPage(row, buf);
+    }
+}
+
+// Copies src's page into dest's page
+void copyPage(struct pageTableRow * dest, struct pageTableRow * src) {
+    if (src->physicalLocation) {
+        writePage(dest, getPageData(src));
+    } else if (dest->physicalLocation) {
+        readPage(src, getPageData(dest));
+    } else {
+        char temp[pageSize];
+        readPage(src, temp);
+        writePage(dest, temp);
+    }
+}
+
 // Swaps the 2 pages. Ends up with row1 refrencing the same
 // memory but now with the page that was originally in row2's
-// memory. Threads and page numbers are also swapped.
+// memory. Threads and page numbers are also swapped. The
+// contents of free pages are not kept. Afterwards the memory
+// pages of both rows are only unprotected if they are
+// accessible to the running thread.
 void swapPages(struct pageTableRow * row1, struct pageTableRow * row2) {
 
     // Don't swap if rows are the same
-    if (row1 != row2) {
+    if (row1 == row2) {
+        if (row1->physicalLocation) { refreshProtection(row1); }
+        return;
+    }
+
+    // Swap the tcbs and pageNumbers of both threads
+    int row1Used = row1->thread != NULL;
+    int row2Used = row2->thread != NULL;
+    int row1WasAccessible = isAccessible(row1);
+    int row2WasAccessible = isAccessible(row2);
+    tcb * tempTcb = row1->thread;
+    unsigned long tempPageNumber = row1->pageNumber;
+    setPageOwner(row1, row2->thread, row2->pageNumber);
+    setPageOwner(row2, tempTcb, tempPageNumber);
+
+    // Swap frames between memory pages by remapping them,
+    // unless userfaultfd is used since remapping unregisters the pages
+    if (row1->physicalLocation && row2->physicalLocation && FRAME_ALIAS && pageSize >= REMAP_PAGE_SIZE && USER_FAULT_FILE == -1) {
+        off_t tempOffset = row1->frameOffset;
+        mapFrame(row1->physicalLocation, row2->frameOffset, isAccessible(row1));
+        mapFrame(row2->physicalLocation, tempOffset, isAccessible(row2));
+        row1->frameOffset = row2->frameOffset;
+        row2->frameOffset = tempOffset;
+        return;
+    }
 
+    // Without an alias, memory pages must be unprotected to be copied
+    if (!FRAME_ALIAS) {
+        if (row1->physicalLocation) { unprotectPages(row1->physicalLocation, 1); }
+        if (row2->physicalLocation) { unprotectPages(row2->physicalLocation, 1); }
+        row1WasAccessible = row2WasAccessible = 1;
+    }
+
+    // Copy the pages that are used
+    if (row1Used && row2Used) {
         char temp[pageSize];
+        readPage(row1, temp);
+        copyPage(row1, row2);
+        writePage(row2, temp);
+    } else if (row1Used) {
+        copyPage(row2, row1);
+    } else if (row2Used) {
+        copyPage(row1, row2);
+    }
 
-        // Copy row1 into temp
-        if (row1->physicalLocation) {
-            COPY_PAGE(temp, row1->physicalLocation);
-        } else {
-            seekSwapFile(row1->virtualLocation);
-            readSwapFilePage(temp);
-        }
+    // Free compressed pages left in a row that ended up free
+    if (!row1->thread) { discardCompressedPage(row1); }
+    if (!row2->thread) { discardCompressedPage(row2); }
 
-        // Copy row2 into row1 and temp into row2
-        if (row2->physicalLocation) {
-            if (row1->physicalLocation) {
-                COPY_PAGE(row1->physicalLocation, row2->physicalLocation);
-            } else {
-                seekSwapFile(row1->virtualLocation);
-                writeSwapFilePage(row2->physicalLocation);
-            }
-            COPY_PAGE(row2->physicalLocation, temp);
-        } else {
-            if (row1->physicalLocation) {
-                seekSwapFile(row2->virtualLocation);
-                readSwapFilePage(row1->physicalLocation);
-            } else {
-                char temp2[pageSize];
-                seekSwapFile(row2->virtualLocation);
-                readSwapFilePage(temp2);
-                seekSwapFile(row1->virtualLocation);
-                writeSwapFilePage(temp2);
-            }
-            seekSwapFile(row2->virtualLocation);
-            writeSwapFilePage(temp);
+    // Only change the protection of pages whose accessibility changed
+    if (row1->physicalLocation && isAccessible(row1) != row1WasAccessible) { refreshProtection(row1); }
+    if (row2->physicalLocation && isAccessible(row2) != row2WasAccessible) { refreshProtection(row2); }
+}
+
+// Returns a memory page other than exclude to move a page into,
+// taking a free memory page if there is one. Otherwise pages are
+// picked in clock order, skipping and unreferencing pages that
+// were referenced since the clock hand last passed them.
+struct pageTableRow * getVictimPage(struct pageTableRow * exclude) {
+    if (FREE_MEM_PGS && FREE_MEM_PGS != exclude) { return FREE_MEM_PGS; }
+    while (1) {
+        struct pageTableRow * row = PG_TBL + CLOCK_HAND;
+        CLOCK_HAND = (CLOCK_HAND + 1) % NUM_MEM_PGS;
+        if (row != exclude) {
+            if (!row->thread) { return row; }
+            if (!row->referenced) { return row; }
+            row->referenced = 0;
         }
+    }
+}
+
+// Gives the running thread its page at address, which must be in
+// the memory pages, swapping it in from wherever it is or giving
+// it an unused page. Returns 0 if there are no pages left else 1.
+int resolveFault(void * address) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    STATS.faults++;
+
+    // Calculating the page number accessed
+    unsigned long offset = UNSGND_LONG(address) - UNSGND_LONG(MEM_PGS);
+    unsigned long pageNumber = offset / pageSize;
+
+    // Use the thread's page if it has one, else give it an unused page
+    struct pageTableRow * pageAccessed = PG_TBL + pageNumber;
+    struct pageTableRow * pageWanted = findPage(currentTcb, pageNumber);
+    struct pageTableRow * newPage = pageWanted ? NULL : getFreePage();
+    struct pageTableRow * target = pageWanted ? pageWanted : newPage;
+    if (!target) { return 0; }
+
+    // If the target is in swapFile, the page being displaced
+    // from the accessed page would end up in swapFile. Instead
+    // the target is brought into a page picked by the clock and
+    // that page's old page is the one evicted to swapFile.
+    if (!target->physicalLocation && pageAccessed->thread) {
+        struct pageTableRow * victim = getVictimPage(pageAccessed);
+        if (victim->thread) { STATS.evictions++; }
+        swapPages(victim, target);
+        target = victim;
+    }
 
-        // Swap the tcbs and pageNumbers of both threads
-        tcb * tempTcb = row1->thread;
-        row1->thread = row2->thread;
-        row2->thread = tempTcb;
-        unsigned long tempPageNumber = row1->pageNumber;
-        row1->pageNumber = row2->pageNumber;
-        row2->pageNumber = tempPageNumber;
+    // Swap the target page into the accessed page. New pages are
+    // zeroed so threads never see what a page's last owner left.
+    swapPages(pageAccessed, target);
+    if (newPage) {
+        setPageOwner(pageAccessed, currentTcb, pageNumber);
+        unprotectPages(pageAccessed->physicalLocation, 1);
+        memset(getPageData(pageAccessed), 0, pageSize);
+    }
+    pageAccessed->referenced = 1;
+
+    // If this is the thread's first page, initialize it's metadata
+    if (newPage && !pageNumber) {
+        struct threadMemoryMetadata * threadMeta = THRD_META_PTR(pageAccessed->physicalLocation);
+        createPartition(&(threadMeta->partition), threadMeta + 1, pageSize - THRD_META_SIZE);
+        threadMeta->trimThresholdPages = TRIM_THRESHOLD_PAGES;
+        threadMeta->runs = NULL;
+        threadMeta->largeAllocSize = LARGE_ALLOC_SIZE;
     }
+
+    // Recording how long the fault took to resolve
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    unsigned long nanoseconds = ((end.tv_sec - start.tv_sec) * 1000000000UL) + end.tv_nsec - start.tv_nsec;
+    STATS.faultNanoseconds += nanoseconds;
+    if (nanoseconds > STATS.maxFaultNanoseconds) { STATS.maxFaultNanoseconds = nanoseconds; }
+    return 1;
 }
 
 // This function is fired when a thread is trying
 // to access it's page but it's not there.
 void onBadAccess(int sig, siginfo_t * si, void * unused) {
 
-    // Calculating the page number accessed
-    unsigned long offset = UNSGND_LONG(si->si_addr) - UNSGND_LONG(MEM_PGS);
-    unsigned long pageNumber = offset / pageSize;
+    // Faults outside the memory pages, like hitting a thread stack's
+    // guard page, are real errors so let them crash the program
+    if (CHAR_PTR(si->si_addr) < MEM_PGS || CHAR_PTR(si->si_addr) >= MEM_PGS + (NUM_MEM_PGS * pageSize)) {
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
 
-    struct pageTableRow * pageAccessed = PG_TBL + pageNumber;
-    struct pageTableRow * pageWanted = NULL;
-    struct pageTableRow * firstFreePage = NULL;
+    // Block the scheduler so the thread isn't switched
+    // out while the fault is being resolved
+    char previousBlock = block;
+    block = 1;
 
-    // Search page table for appropriate page
-    unsigned long i;
-    for (i = 0; i < NUM_PGS; i++) {
-        if (PG_TBL[i].thread == currentTcb && PG_TBL[i].pageNumber == pageNumber) {
-            pageWanted = PG_TBL + i;
-            break;
-        } else if (!firstFreePage && !PG_TBL[i].thread) {
-            firstFreePage = PG_TBL + i;
+    // Out of pages, let the access crash the program
+    if (!resolveFault(si->si_addr)) { signal(SIGSEGV, SIG_DFL); }
+
+    block = previousBlock;
+}
+
+// Reads faults on the memory pages from userfaultfd and resolves
+// them on its own kernel thread while the faulting thread waits in
+// the kernel. A signal can pull the faulting thread out of the wait
+// and drop its fault if it wasn't read yet, so the timer checks
+// isResolvingFault() which is set before each fault is read.
+void * resolveUserFaults(void * unused) {
+    struct pollfd pending;
+    pending.fd = USER_FAULT_FILE;
+    pending.events = POLLIN;
+    struct uffd_msg message;
+    while (poll(&pending, 1, -1) != -1 || errno == EINTR) {
+        __atomic_store_n(&RESOLVING_FAULT, 1, __ATOMIC_SEQ_CST);
+        if (read(USER_FAULT_FILE, &message, sizeof(message)) == sizeof(message) && message.event == UFFD_EVENT_PAGEFAULT) {
+
+            // Out of pages, crash the program like the signal handler would
+            void * address = VOID_PTR(message.arg.pagefault.address);
+            if (!resolveFault(address)) {
+                signal(SIGSEGV, SIG_DFL);
+                kill(getpid(), SIGSEGV);
+            }
+
+            // Wake the faulting thread now that its page is ready
+            __atomic_store_n(&RESOLVING_FAULT, 0, __ATOMIC_SEQ_CST);
+            struct uffdio_range range;
+            range.start = UNSGND_LONG(address) & ~(pageSize - 1);
+            range.len = pageSize;
+            ioctl(USER_FAULT_FILE, UFFDIO_WAKE, &range);
         }
+        __atomic_store_n(&RESOLVING_FAULT, 0, __ATOMIC_SEQ_CST);
     }
+    return NULL;
+}
 
-    // Swap pages if thread owns the the page it was trying to access
-    if (pageWanted) {
-        unprotectPages(pageAccessed->physicalLocation, 1);
-        swapPages(pageAccessed, pageWanted);
-        protectPages(pageWanted->physicalLocation, 1);
-
-    // Give the thread an unused page if it doesn't have one and then swap
-    } else if (firstFreePage) {
-        if (firstFreePage->physicalLocation) {
-            unprotectPages(firstFreePage->physicalLocation, 1);
-        }
-        if (firstFreePage != pageAccessed) {
-            unprotectPages(pageAccessed->physicalLocation, 1);
-            swapPages(pageAccessed, firstFreePage);
-            if (firstFreePage->physicalLocation) {
-                protectPages(firstFreePage->physicalLocation, 1);
-            }
+// Returns 1 if the userfaultfd thread may be resolving a fault,
+// which the timer must not switch threads during, else returns 0.
+// The interrupted thread would retry its access once the timer
+// returns and could run on a page that's mapped but not filled
+// yet, so this waits for the fault to be resolved first.
+int isResolvingFault() {
+    if (!memory || USER_FAULT_FILE == -1 || !__atomic_load_n(&RESOLVING_FAULT, __ATOMIC_SEQ_CST)) { return 0; }
+    while (__atomic_load_n(&RESOLVING_FAULT, __ATOMIC_SEQ_CST)) { }
+    return 1;
+}
+
+// Switches to catching faults on the memory pages with userfaultfd.
+// The memory pages are mapped unprotected over frames that are all
+// populated, so unmapped pages raise minor faults which are resolved
+// by a kernel thread with every signal blocked. Leaves pages to be
+// mprotected if userfaultfd can't be used.
+void startUserFaults() {
+    USER_FAULT_FILE = syscall(SYS_userfaultfd, O_CLOEXEC|O_NONBLOCK|UFFD_USER_MODE_ONLY);
+    RESOLVING_FAULT = 0;
+    if (USER_FAULT_FILE == -1) { return; }
+    struct uffdio_api api;
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_MINOR_SHMEM;
+    struct uffdio_register registration;
+    registration.range.start = UNSGND_LONG(MEM_PGS);
+    registration.range.len = NUM_MEM_PGS * pageSize;
+    registration.mode = UFFDIO_REGISTER_MODE_MINOR;
+    sigset_t allSignals, previousSignals;
+    sigfillset(&allSignals);
+    pthread_t handler;
+    int started = 0;
+    if (ioctl(USER_FAULT_FILE, UFFDIO_API, &api) == 0 &&
+            fallocate(FRAME_FILE, 0, 0, NUM_MEM_PGS * pageSize) == 0 &&
+            mmap(MEM_PGS, NUM_MEM_PGS * pageSize, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_SHARED|MAP_FIXED, FRAME_FILE, 0) != MAP_FAILED &&
+            ioctl(USER_FAULT_FILE, UFFDIO_REGISTER, &registration) == 0) {
+        pthread_sigmask(SIG_SETMASK, &allSignals, &previousSignals);
+        started = pthread_create(&handler, NULL, resolveUserFaults, NULL) == 0;
+        pthread_sigmask(SIG_SETMASK, &previousSignals, NULL);
+    }
+    if (started) { pthread_detach(handler); }
+    else {
+        close(USER_FAULT_FILE);
+        USER_FAULT_FILE = -1;
+    }
+}
+
+// Frees thread's page with pageNumber if it has one,
+// protecting it if it was accessible. The page's row
+// goes back to its free list.
+void releasePage(tcb * thread, unsigned long pageNumber) {
+    struct pageTableRow * row = findPage(thread, pageNumber);
+    if (!row) { return; }
+    int wasAccessible = isAccessible(row);
+    setPageOwner(row, NULL, 0);
+    discardCompressedPage(row);
+    if (wasAccessible) { protectPages(row->physicalLocation, 1); }
+    STATS.releasedPages++;
+}
+
+// Shrinks the running thread's partition to give back the whole
+// pages at its end if its last block is free and at least the
+// thread's trim threshold of pages can go. The block keeps room
+// for its metadata on the page where it starts.
+void trimThreadPartition() {
+    struct memoryPartition * partition = &THRD_MEM_PART;
+    if (partition->lastTail->used) { return; }
+    struct blockMetadata * lastHead = getHead(partition->lastTail);
+    char * end = CHAR_PTR(partition->lastTail + 1);
+    char * newEnd = CHAR_PTR(ALIGN_PAGE(UNSGND_LONG(lastHead) + BLK_SIZE(MIN_PAYLOAD_SIZE)));
+    size_t numPages = (end - newEnd) / pageSize;
+    if (numPages < THRD_MEM->trimThresholdPages) { return; }
+    THRD_MEM->trimThresholdPages = numPages + 1;
+    removeFreeBlock(lastHead, partition);
+    setBlockMetadata(lastHead, 0, newEnd - CHAR_PTR(lastHead) - DBL_BLK_META_SIZE);
+    partition->lastTail = getTail(lastHead);
+    insertFreeBlock(lastHead, partition);
+    unsigned long pageNumber;
+    for (pageNumber = (newEnd - MEM_PGS) / pageSize; pageNumber < (unsigned long) ((end - MEM_PGS) / pageSize); pageNumber++) {
+        releasePage(currentTcb, pageNumber);
+    }
+}
+
+// Returns the bucket in the heap profile's samples for ptr
+struct heapSample ** getSampleBucket(void * ptr) {
+    return HEAP_PROFILE->samples + ((UNSGND_LONG(ptr) >> 4) % NUM_SAMPLE_BUCKETS);
+}
+
+// Returns the heap profile's entry for fileName and lineNumber,
+// adding it if there isn't one. Returns NULL if there's no room.
+struct callSite * getCallSite(char * fileName, int lineNumber) {
+    struct callSite ** bucket = HEAP_PROFILE->sites + ((UNSGND_LONG(fileName) + lineNumber) % NUM_SITE_BUCKETS);
+    struct callSite * site;
+    for (site = *bucket; site; site = site->next) {
+        if (site->fileName == fileName && site->lineNumber == lineNumber) { return site; }
+    }
+    site = allocateFrom(sizeof(struct callSite), &LIB_MEM_PART);
+    if (!site) { return NULL; }
+    memset(site, 0, sizeof(struct callSite));
+    site->fileName = fileName;
+    site->lineNumber = lineNumber;
+    site->next = *bucket;
+    *bucket = site;
+    return site;
+}
+
+// Returns the heap profile's entry for thread, adding it
+// if there isn't one. Returns NULL if there's no room.
+struct threadProfile * getThreadProfile(tcb * thread) {
+    struct threadProfile * profile;
+    for (profile = HEAP_PROFILE->threads; profile; profile = profile->next) {
+        if (profile->thread == thread) { return profile; }
+    }
+    profile = allocateFrom(sizeof(struct threadProfile), &LIB_MEM_PART);
+    if (!profile) { return NULL; }
+    memset(profile, 0, sizeof(struct threadProfile));
+    profile->thread = thread;
+    profile->next = HEAP_PROFILE->threads;
+    HEAP_PROFILE->threads = profile;
+    return profile;
+}
+
+// Orders call sites by live bytes, most first
+int compareCallSites(const void * a, const void * b) {
+    size_t aBytes = (*(struct callSite **) a)->liveBytes;
+    size_t bBytes = (*(struct callSite **) b)->liveBytes;
+    return aBytes < bBytes ? 1 : aBytes > bBytes ? -1 : 0;
+}
+
+// Writes the heap profile to stderr with call sites sorted by their
+// live bytes, followed by the live threads
+void dumpHeapProfile() {
+    if (!memory || !HEAP_PROFILE) { return; }
+    HEAP_PROFILE->dumpRequested = 0;
+    char previousBlock = block;
+    block = 1;
+    size_t numSites = 0;
+    int i;
+    struct callSite * site;
+    for (i = 0; i < NUM_SITE_BUCKETS; i++) {
+        for (site = HEAP_PROFILE->sites[i]; site; site = site->next) { numSites++; }
+    }
+    struct callSite ** sorted = allocateFrom(sizeof(struct callSite *) * (numSites + 1), &LIB_MEM_PART);
+    size_t numSorted = 0;
+    for (i = 0; sorted && i < NUM_SITE_BUCKETS; i++) {
+        for (site = HEAP_PROFILE->sites[i]; site; site = site->next) { sorted[numSorted++] = site; }
+    }
+    if (sorted) { qsort(sorted, numSorted, sizeof(struct callSite *), compareCallSites); }
+
+    fprintf(stderr, "heap profile, sampling every %lu bytes\n", HEAP_PROFILE->sampleInterval);
+    fprintf(stderr, "%12s %12s %12s %12s  %s\n", "live bytes", "peak bytes", "allocated", "allocations", "site");
+    size_t j;
+    for (j = 0; j < numSorted; j++) {
+        site = sorted[j];
+        fprintf(stderr, "%12lu %12lu %12lu %12lu  %s:%d\n", site->liveBytes, site->peakBytes, site->allocatedBytes, site->allocations, site->fileName ? site->fileName : "unknown", site->lineNumber);
+    }
+    struct threadProfile * profile;
+    for (profile = HEAP_PROFILE->threads; profile; profile = profile->next) {
+        fprintf(stderr, "thread %p: live %lu bytes, peak %lu bytes, %lu allocations\n", VOID_PTR(profile->thread), profile->liveBytes, profile->peakBytes, profile->allocations);
+    }
+    if (sorted) { deallocateFrom(sorted, &LIB_MEM_PART); }
+    block = previousBlock;
+}
+
+// Asks for the heap profile to be written at the
+// next allocation or free as a thread
+void requestHeapProfile(int signum) {
+    HEAP_PROFILE->dumpRequested = 1;
+}
+
+// Records the running thread's allocation of size bytes at ptr from
+// the call site at fileName and lineNumber if it's sampled. Sampled
+// allocations smaller than the sample interval stand for that many
+// bytes since about one in interval / size of them is sampled.
+void profileAllocation(void * ptr, size_t size, char * fileName, int lineNumber) {
+    struct heapProfile * profile = HEAP_PROFILE;
+    if (profile->dumpRequested) { dumpHeapProfile(); }
+    if (profile->sampleInterval) {
+        // Compared before subtracting so a huge size can't wrap the count
+        if ((size_t) profile->bytesUntilSample > size) {
+            profile->bytesUntilSample -= (long) size;
+            return;
         }
-        pageAccessed->thread = currentTcb;
-        pageAccessed->pageNumber = pageNumber;
 
-        // If this is the thread's first page, initialize it's metadata
-        if (!pageNumber) {
-            struct threadMemoryMetadata * threadMeta = THRD_META_PTR(pageAccessed->physicalLocation);
-            threadMeta->partition = createPartition(threadMeta + 1, pageSize - THRD_META_SIZE);
+        // Next sample is a random 1 to 2 * sampleInterval bytes away
+        profile->randomState ^= profile->randomState << 13;
+        profile->randomState ^= profile->randomState >> 7;
+        profile->randomState ^= profile->randomState << 17;
+        profile->bytesUntilSample = (profile->randomState % (profile->sampleInterval * 2)) + 1;
+    }
+    struct callSite * site = getCallSite(fileName, lineNumber);
+    struct threadProfile * thread = getThreadProfile(currentTcb);
+    struct heapSample * sample = allocateFrom(sizeof(struct heapSample), &LIB_MEM_PART);
+    if (!site || !thread || !sample) {
+        if (sample) { deallocateFrom(sample, &LIB_MEM_PART); }
+        return;
+    }
+    size_t bytes = size < profile->sampleInterval ? profile->sampleInterval : size;
+    size_t allocations = bytes / size;
+    sample->ptr = ptr;
+    sample->bytes = bytes;
+    sample->site = site;
+    sample->thread = thread;
+    struct heapSample ** bucket = getSampleBucket(ptr);
+    sample->next = *bucket;
+    *bucket = sample;
+    site->liveBytes += bytes;
+    site->allocatedBytes += bytes;
+    site->allocations += allocations;
+    if (site->liveBytes > site->peakBytes) { site->peakBytes = site->liveBytes; }
+    thread->liveBytes += bytes;
+    thread->allocations += allocations;
+    if (thread->liveBytes > thread->peakBytes) { thread->peakBytes = thread->liveBytes; }
+}
+
+// Removes the sample for the allocation at ptr, if it was sampled,
+// from its call site and thread and returns it. Returns NULL if
+// the allocation wasn't sampled.
+struct heapSample * removeSample(void * ptr) {
+    struct heapSample ** link;
+    for (link = getSampleBucket(ptr); *link; link = &((*link)->next)) {
+        struct heapSample * sample = *link;
+        if (sample->ptr == ptr) {
+            *link = sample->next;
+            sample->site->liveBytes -= sample->bytes;
+            sample->thread->liveBytes -= sample->bytes;
+            return sample;
         }
-    }  
+    }
+    return NULL;
+}
+
+// Records that the allocation at ptr was freed
+void profileFree(void * ptr) {
+    if (HEAP_PROFILE->dumpRequested) { dumpHeapProfile(); }
+    struct heapSample * sample = removeSample(ptr);
+    if (sample) { deallocateFrom(sample, &LIB_MEM_PART); }
+}
+
+// Drops the samples of thread's allocations, which are gone with
+// its pages, and its entry in the heap profile. Called when it exits.
+void releaseHeapProfile(tcb * thread) {
+    struct threadProfile ** link;
+    for (link = &(HEAP_PROFILE->threads); *link && (*link)->thread != thread; link = &((*link)->next));
+    if (!*link) { return; }
+    struct threadProfile * profile = *link;
+    int i;
+    for (i = 0; i < NUM_SAMPLE_BUCKETS && profile->liveBytes; i++) {
+        struct heapSample ** sampleLink = HEAP_PROFILE->samples + i;
+        while (*sampleLink) {
+            struct heapSample * sample = *sampleLink;
+            if (sample->thread != profile) {
+                sampleLink = &(sample->next);
+                continue;
+            }
+            *sampleLink = sample->next;
+            sample->site->liveBytes -= sample->bytes;
+            profile->liveBytes -= sample->bytes;
+            deallocateFrom(sample, &LIB_MEM_PART);
+        }
+    }
+    *link = profile->next;
+    deallocateFrom(profile, &LIB_MEM_PART);
+}
+
+// Allocates thread's bitmap of resident pages, which every thread
+// needs before it's given pages. Returns 0 on success or -1 if the
+// library's partition is out of space.
+int initializeThreadMemory(tcb * thread) {
+    thread->residentPages = allocateFrom(RESIDENT_PGS_SIZE, &LIB_MEM_PART);
+    if (!thread->residentPages) { return -1; }
+    memset(thread->residentPages, 0, RESIDENT_PGS_SIZE);
+    return 0;
+}
+
+// Frees all pages and page tracking of thread. The thread must
+// not be running so its memory pages are already protected.
+void releaseThreadMemory(tcb * thread) {
+    if (HEAP_PROFILE) { releaseHeapProfile(thread); }
+    while (thread->pages) { releasePage(thread, thread->pages->pageNumber); }
+    if (thread->residentPages) {
+        deallocateFrom(thread->residentPages, &LIB_MEM_PART);
+        thread->residentPages = NULL;
+    }
 }
 
 // Last function called before
-// program exits. Closes swapFile.
+// program exits. Unmaps and closes swapFile and closes the frame file.
 void cleanup() {
+    if (HEAP_PROFILE) { dumpHeapProfile(); }
+    if (SWAP_MAP) { munmap(SWAP_MAP, SWAP_SIZE); }
     close(SWAP_FILE);
+    if (FRAME_FILE != -1) { close(FRAME_FILE); }
 }
 
 // Initializes the memory manager only if
@@ -366,8 +1566,10 @@ void initializeMemory() {
         }
 
         // Setting memory's metadata based on calculated numbers
-        LIB_MEM_PART = createPartition(MEM_INFO + 1, libraryMemorySize);
-        SHRD_MEM_PART = createPartition(memory + MEM_SIZE - SHRD_MEM_SIZE, SHRD_MEM_SIZE);
+        createPartition(&LIB_MEM_PART, MEM_INFO + 1, libraryMemorySize);
+        createPartition(&SHRD_MEM_PART, memory + MEM_SIZE - SHRD_MEM_SIZE, SHRD_MEM_SIZE);
+        SHRD_ARENAS = NULL;
+        memset(SHRD_DEPOTS, 0, sizeof(SHRD_DEPOTS));
         PG_TBL = PG_TBL_ROW_PTR(memory + MEM_META_SIZE + libraryMemorySize);
         NUM_MEM_PGS = numMemPages;
         NUM_SWAP_PGS = numSwapPages;
@@ -382,31 +1584,115 @@ void initializeMemory() {
         atexit(cleanup);
 
         // Create 16MB swap file
-        seekSwapFile(SWAP_SIZE - 1);
-        if (write(SWAP_FILE, "\0", 1) == -1) {
+        if (pwrite(SWAP_FILE, "\0", 1, SWAP_SIZE - 1) == -1) {
             fprintf(stderr, "Error initializing swapFile to 16MB: %s\n", strerror(errno));
             exit(EXIT_FAILURE);
         }
 
-        // Initializing the page table
+        // Mapping swapFile if selected, falling back to reading and
+        // writing it if it can't be mapped. Otherwise allocating the
+        // buffer for pages waiting to be written to swapFile.
+        char * swapMode = getenv(SWAP_MODE_ENV);
+        SWAP_MAP = NULL;
+        SWAP_WRITE_BUF = NULL;
+        NUM_PENDING_WRITES = 0;
+        if (swapMode && !strcmp(swapMode, "mmap")) {
+            SWAP_MAP = mmap(NULL, SWAP_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, SWAP_FILE, 0);
+            if (SWAP_MAP == MAP_FAILED) { SWAP_MAP = NULL; }
+        }
+        if (!SWAP_MAP) { SWAP_WRITE_BUF = allocateFrom(SWAP_WRITE_BATCH * pageSize, &LIB_MEM_PART); }
+        if (!SWAP_MAP && !SWAP_WRITE_BUF) {
+            fprintf(stderr, "Error allocating swapFile write buffer\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // The compressed pool is allocated when the first page leaves memory
+        CMPRS_TABLE = NULL;
+        CMPRS_BUF = NULL;
+        CMPRS_DISABLED = 0;
+
+        // Initializing the page hash table with at least one bucket per page
+        NUM_PG_BUCKETS = 1;
+        while (NUM_PG_BUCKETS < numPages) { NUM_PG_BUCKETS *= 2; }
+        PG_BUCKETS = allocateFrom(NUM_PG_BUCKETS * sizeof(struct pageTableRow *), &LIB_MEM_PART);
+        memset(PG_BUCKETS, 0, NUM_PG_BUCKETS * sizeof(struct pageTableRow *));
+
+        // Initializing the page table with every page in a free list,
+        // inserting backwards so lower pages are handed out first
+        FREE_MEM_PGS = NULL;
+        FREE_SWAP_PGS = NULL;
+        NUM_USED_PGS = 0;
+        CLOCK_HAND = 0;
+        memset(&STATS, 0, sizeof(struct memoryStats));
         off_t i;
         for (i = 0; i < numMemPages; i++) {
             PG_TBL[i].thread = NULL;
             PG_TBL[i].physicalLocation = MEM_PGS + (i * pageSize);
             PG_TBL[i].virtualLocation = -1;
+            PG_TBL[i].frameOffset = i * pageSize;
+            PG_TBL[i].compressedLocation = NULL;
+            PG_TBL[i].referenced = 0;
         }
         off_t j;
-        for (j = 0; j < numSwapPages; j += pageSize) {
+        for (j = 0; j < numSwapPages; j++) {
             PG_TBL[i].thread = NULL;
             PG_TBL[i].physicalLocation = NULL;
-            PG_TBL[i].virtualLocation = j;
+            PG_TBL[i].virtualLocation = j * pageSize;
+            PG_TBL[i].compressedLocation = NULL;
+            PG_TBL[i].referenced = 0;
             i++;
         }
+        while (i > 0) { insertPageRow(PG_TBL + (--i)); }
+
+        // Backing the memory pages with a memory file that is also
+        // mapped unprotected as an alias, so the library can copy pages
+        // without changing their protection and can swap big pages by
+        // remapping them. Falls back to unprotecting pages to copy them
+        // if the file can't be made.
+        FRAME_FILE = memfd_create("threadPages", 0);
+        FRAME_ALIAS = NULL;
+        if (FRAME_FILE != -1) {
+            if (ftruncate(FRAME_FILE, numMemPages * pageSize) == 0) {
+                FRAME_ALIAS = mmap(NULL, numMemPages * pageSize, PROT_READ|PROT_WRITE, MAP_SHARED, FRAME_FILE, 0);
+            }
+            if (!FRAME_ALIAS || FRAME_ALIAS == MAP_FAILED ||
+                    mmap(MEM_PGS, numMemPages * pageSize, PROT_NONE, MAP_SHARED|MAP_FIXED, FRAME_FILE, 0) == MAP_FAILED) {
+                if (FRAME_ALIAS && FRAME_ALIAS != MAP_FAILED) { munmap(FRAME_ALIAS, numMemPages * pageSize); }
+                close(FRAME_FILE);
+                FRAME_FILE = -1;
+                FRAME_ALIAS = NULL;
+            }
+        }
+        char * remapSize = getenv(REMAP_SIZE_ENV);
+        REMAP_PAGE_SIZE = remapSize ? atol(remapSize) : MIN_REMAP_PAGE_SIZE;
+
+        // Catching faults with userfaultfd if selected, which needs the frame file
+        char * faultMode = getenv(FAULT_MODE_ENV);
+        USER_FAULT_FILE = -1;
+        if (faultMode && !strcmp(faultMode, "userfaultfd") && FRAME_ALIAS) { startUserFaults(); }
+
+        // Starting the heap profiler if selected
+        char * heapProfile = getenv(HEAP_PROFILE_ENV);
+        HEAP_PROFILE = NULL;
+        if (heapProfile) { HEAP_PROFILE = allocateFrom(sizeof(struct heapProfile), &LIB_MEM_PART); }
+        if (HEAP_PROFILE) {
+            memset(HEAP_PROFILE, 0, sizeof(struct heapProfile));
+            HEAP_PROFILE->sampleInterval = strtoul(heapProfile, NULL, 10);
+            HEAP_PROFILE->randomState = UNSGND_LONG(getpid()) | 1;
+            HEAP_PROFILE->bytesUntilSample = HEAP_PROFILE->sampleInterval;
+            struct sigaction dumpAction;
+            dumpAction.sa_flags = SA_NODEFER | SA_RESTART;
+            sigemptyset(&dumpAction.sa_mask);
+            dumpAction.sa_handler = requestHeapProfile;
+            sigaction(SIGUSR1, &dumpAction, NULL);
+        }
 
-        // Setting signal handler to be fired on bad page access
+        // Setting signal handler to be fired on bad page access. Like the
+        // timer's, it's SA_NODEFER since threads switched from inside it
+        // don't get their signal masks restored.
         protectPages(MEM_PGS, numMemPages);
         struct sigaction sa;
-        sa.sa_flags = SA_SIGINFO;
+        sa.sa_flags = SA_SIGINFO | SA_NODEFER;
         sigemptyset(&sa.sa_mask);
         sa.sa_sigaction = onBadAccess;
         if (sigaction(SIGSEGV, &sa, NULL) == -1) {
@@ -416,52 +1702,376 @@ void initializeMemory() {
     }
 }
 
-// Returns 1 if thread can extend its pages else returns 0
-int canExtend(tcb * thread) {
-    unsigned int numThreadPages;
-    unsigned int totalUsedPages;
-    unsigned int i;
-    for (i = 0; i < NUM_PGS; i++) {
-        if (PG_TBL[i].thread) {
-            totalUsedPages++;
-            if (PG_TBL[i].thread == thread) {
-                numThreadPages++;
-                if (numThreadPages == NUM_MEM_PGS) { return 0; }
+// Returns 1 if thread can extend its pages by numPages else returns 0
+int canExtend(tcb * thread, size_t numPages) {
+    return thread->numPages + numPages <= NUM_MEM_PGS && NUM_USED_PGS + numPages <= NUM_PGS;
+}
+
+// Returns where the running thread's lowest run of pages starts,
+// which its partition can't grow past
+char * getRunsStart() {
+    if (THRD_MEM->runs) { return CHAR_PTR(THRD_MEM->runs); }
+    return THRD_MEM_END;
+}
+
+// Extends the running thread's partition by enough whole pages at
+// once for an allocation of size, if it stays below the thread's
+// runs of pages. Returns 0 if it can't be extended else returns 1.
+int extendThreadPartition(size_t size) {
+    struct memoryPartition * partition = &THRD_MEM_PART;
+    size_t needed = ALIGN_PAYLOAD(size < MIN_PAYLOAD_SIZE ? MIN_PAYLOAD_SIZE : size);
+    if (partition->lastTail->used) { needed += DBL_BLK_META_SIZE; }
+    else if (partition->lastTail->payloadSize < needed) { needed -= partition->lastTail->payloadSize; }
+    size_t numPages = ALIGN_PAGE(needed) / pageSize;
+    if (PARTITION_END(partition) + (numPages * pageSize) > getRunsStart() || !canExtend(currentTcb, numPages)) { return 0; }
+    extendPartition(partition, numPages * pageSize);
+    return 1;
+}
+
+// Allocates size bytes in a run of pages placed at the top of the
+// highest gap between the running thread's partition and its runs
+// that fits it. The run's pages are faulted in as they're used.
+// Returns NULL if no gap fits.
+void * allocateRun(size_t size) {
+    size_t numPages = ALIGN_PAGE(size + RUN_HEADER_SIZE) / pageSize;
+    if (!canExtend(currentTcb, numPages)) { return NULL; }
+    char * gapStart = PARTITION_END(&THRD_MEM_PART);
+    struct largeRun * below = NULL;
+    struct largeRun * above = THRD_MEM->runs;
+    char * runStart = NULL;
+    struct largeRun * runBelow = NULL;
+    while (1) {
+        char * gapEnd = above ? CHAR_PTR(above) : THRD_MEM_END;
+        if ((size_t) (gapEnd - gapStart) >= numPages * pageSize) {
+            runStart = gapEnd - (numPages * pageSize);
+            runBelow = below;
+        }
+        if (!above) { break; }
+        gapStart = CHAR_PTR(above) + (above->numPages * pageSize);
+        below = above;
+        above = above->next;
+    }
+    if (!runStart) { return NULL; }
+
+    // Chain the run in after the run below it
+    struct largeRun * run = (struct largeRun *) runStart;
+    run->numPages = numPages;
+    run->previous = runBelow;
+    run->next = runBelow ? runBelow->next : THRD_MEM->runs;
+    if (run->next) { run->next->previous = run; }
+    if (runBelow) { runBelow->next = run; }
+    else { THRD_MEM->runs = run; }
+    return CHAR_PTR(run) + RUN_HEADER_SIZE;
+}
+
+// Frees ptr's run of pages if ptr is in one of the running
+// thread's runs, giving its pages back as a unit. Returns 0
+// if ptr isn't in a run else returns 1.
+int deallocateRun(void * ptr) {
+    if (CHAR_PTR(ptr) < getRunsStart() || CHAR_PTR(ptr) >= THRD_MEM_END) { return 0; }
+    struct largeRun * run = RUN_PTR(ptr);
+    if (run->previous) { run->previous->next = run->next; }
+    else { THRD_MEM->runs = run->next; }
+    if (run->next) { run->next->previous = run->previous; }
+    size_t runSize = (run->numPages * pageSize) - RUN_HEADER_SIZE;
+    if (runSize > THRD_MEM->largeAllocSize && runSize <= (size_t) MAX_LARGE_ALLOC_SIZE) { THRD_MEM->largeAllocSize = runSize + 1; }
+    unsigned long firstPage = (CHAR_PTR(run) - MEM_PGS) / pageSize;
+    unsigned long pageNumber;
+    for (pageNumber = firstPage + run->numPages; pageNumber > firstPage; pageNumber--) {
+        releasePage(currentTcb, pageNumber - 1);
+    }
+    return 1;
+}
+
+// Frees ptr from the shared memory partition or the shared arena
+// it's in. An arena left empty goes back to the library's partition.
+// Returns 0 if ptr isn't shared memory else returns 1.
+int deallocateShared(void * ptr) {
+    if (deallocateFrom(ptr, &SHRD_MEM_PART)) { return 1; }
+    struct sharedArena ** link;
+    for (link = &SHRD_ARENAS; *link; link = &((*link)->next)) {
+        struct sharedArena * arena = *link;
+        if (deallocateFrom(ptr, &(arena->partition))) {
+            if (!arena->partition.firstHead->used && getTail(arena->partition.firstHead) == arena->partition.lastTail) {
+                *link = arena->next;
+                deallocateFrom(arena, &LIB_MEM_PART);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Returns the index of the magazines for shared blocks with
+// payloadSize, or -1 if blocks of that size aren't cached
+int getCachedSize(size_t payloadSize) {
+    if (payloadSize > MAX_CACHED_SIZE) { return -1; }
+    return (payloadSize / BLK_META_SIZE) - 1;
+}
+
+// Returns an empty magazine from depot, or a new one from the
+// library's partition if it has none. Returns NULL if no room.
+struct magazine * getEmptyMagazine(struct magazineDepot * depot) {
+    struct magazine * magazine = depot->empty;
+    if (magazine) { depot->empty = magazine->next; }
+    else {
+        magazine = allocateFrom(sizeof(struct magazine), &LIB_MEM_PART);
+        if (magazine) { magazine->numBlocks = 0; }
+    }
+    return magazine;
+}
+
+// Frees the blocks in magazine to their shared
+// partitions and gives it to depot as an empty magazine
+void drainMagazine(struct magazine * magazine, struct magazineDepot * depot) {
+    while (magazine->numBlocks) { deallocateShared(magazine->blocks[--magazine->numBlocks]); }
+    magazine->next = depot->empty;
+    depot->empty = magazine;
+}
+
+// Gives the full magazine to depot, draining it instead
+// if depot already has MAX_DEPOT_MAGAZINES full ones
+void putFullMagazine(struct magazine * magazine, struct magazineDepot * depot) {
+    if (depot->numFull >= MAX_DEPOT_MAGAZINES) {
+        drainMagazine(magazine, depot);
+        return;
+    }
+    magazine->next = depot->full;
+    depot->full = magazine;
+    depot->numFull++;
+}
+
+// Takes a cached shared block with payloadSize for the running thread.
+// When its loaded magazine is empty, its previous magazine is swapped
+// in if that has blocks, else the empty previous goes to the depot
+// and a full one is loaded from it. Returns NULL if none are cached.
+void * takeCachedShared(size_t payloadSize) {
+    int sizeIndex = getCachedSize(payloadSize);
+    if (sizeIndex < 0 || !currentTcb || !currentTcb->sharedCache) { return NULL; }
+    struct magazine ** loaded = currentTcb->sharedCache->loaded + sizeIndex;
+    struct magazine ** previous = currentTcb->sharedCache->previous + sizeIndex;
+    if (!*loaded || !(*loaded)->numBlocks) {
+        struct magazineDepot * depot = SHRD_DEPOTS + sizeIndex;
+        struct magazine * swapped = *loaded;
+        if (*previous && (*previous)->numBlocks) {
+            *loaded = *previous;
+            *previous = swapped;
+        } else if (depot->full) {
+            if (*previous) {
+                (*previous)->next = depot->empty;
+                depot->empty = *previous;
             }
+            *previous = swapped;
+            *loaded = depot->full;
+            depot->full = depot->full->next;
+            depot->numFull--;
+        } else { return NULL; }
+    }
+    return (*loaded)->blocks[--(*loaded)->numBlocks];
+}
+
+// Caches the freed shared block at ptr in the running thread's
+// magazines. When its loaded magazine is full, its previous magazine
+// is swapped in if that has room, else the full previous goes to the
+// depot and an empty one is loaded from it. Returns 0 if the block
+// isn't cached else returns 1.
+int cacheShared(void * ptr) {
+    int sizeIndex = getCachedSize((BLK_META_PTR(ptr) - 1)->payloadSize);
+    if (sizeIndex < 0 || !currentTcb) { return 0; }
+    if (!currentTcb->sharedCache) {
+        currentTcb->sharedCache = allocateFrom(sizeof(struct sharedCache), &LIB_MEM_PART);
+        if (!currentTcb->sharedCache) { return 0; }
+        memset(currentTcb->sharedCache, 0, sizeof(struct sharedCache));
+    }
+    struct magazine ** loaded = currentTcb->sharedCache->loaded + sizeIndex;
+    struct magazine ** previous = currentTcb->sharedCache->previous + sizeIndex;
+    if (!*loaded || (*loaded)->numBlocks == MAGAZINE_SIZE) {
+        struct magazineDepot * depot = SHRD_DEPOTS + sizeIndex;
+        struct magazine * swapped = *loaded;
+        if (*previous && (*previous)->numBlocks < MAGAZINE_SIZE) {
+            *loaded = *previous;
+            *previous = swapped;
+        } else {
+            struct magazine * empty = getEmptyMagazine(depot);
+            if (!empty) { return 0; }
+            if (*previous) { putFullMagazine(*previous, depot); }
+            *previous = swapped;
+            *loaded = empty;
         }
     }
-    if (totalUsedPages == NUM_PGS) { return 0; }
+    (*loaded)->blocks[(*loaded)->numBlocks++] = ptr;
     return 1;
 }
 
-// Allocates size bytes from partition. Returns a pointer
-// to the allocated memory or NULL if there is no space.
-void * allocateFrom(size_t size, struct memoryPartition * partition) {
+// Gives thread's magazines to the depots, full ones as they are and
+// the rest drained, and frees its cache. Called when thread exits.
+void releaseSharedCache(tcb * thread) {
+    struct sharedCache * cache = thread->sharedCache;
+    if (!cache) { return; }
+    int sizeIndex;
+    for (sizeIndex = 0; sizeIndex < NUM_CACHED_SIZES; sizeIndex++) {
+        struct magazine * magazines[2] = { cache->loaded[sizeIndex], cache->previous[sizeIndex] };
+        int i;
+        for (i = 0; i < 2; i++) {
+            if (!magazines[i]) { continue; }
+            if (magazines[i]->numBlocks == MAGAZINE_SIZE) { putFullMagazine(magazines[i], SHRD_DEPOTS + sizeIndex); }
+            else { drainMagazine(magazines[i], SHRD_DEPOTS + sizeIndex); }
+        }
+    }
+    deallocateFrom(cache, &LIB_MEM_PART);
+    thread->sharedCache = NULL;
+}
 
-    struct blockMetadata * head = partition->firstHead;
-    
-    // Searches for first free block with at least size bytes
-    while (head->used || size > head->payloadSize) {
-        head = BLK_META_PTR(CHAR_PTR(head) + BLK_SIZE(head->payloadSize));
-        if ((head - 1) == partition->lastTail) { return NULL; }
+// Allocates size bytes aligned to alignment from the running thread's
+// cached shared blocks, the shared memory partition or a shared arena,
+// adding an arena big enough for size from the library's partition if
+// none have room. Returns NULL if there's no room.
+void * allocateShared(size_t size, size_t alignment) {
+    void * ret = NULL;
+    if (alignment <= BLK_META_SIZE) { ret = takeCachedShared(ALIGN_PAYLOAD(size < MIN_PAYLOAD_SIZE ? MIN_PAYLOAD_SIZE : size)); }
+    if (!ret) { ret = allocateAlignedFrom(size, alignment, &SHRD_MEM_PART); }
+    struct sharedArena * arena;
+    for (arena = SHRD_ARENAS; !ret && arena; arena = arena->next) {
+        ret = allocateAlignedFrom(size, alignment, &(arena->partition));
     }
+    if (ret) { return ret; }
+
+    // Room for the arena, aligning its partition, and the block
+    size_t arenaSize = sizeof(struct sharedArena) + BLK_META_SIZE + BLK_SIZE(ALIGN_PAYLOAD(size));
+    if (alignment > BLK_META_SIZE) { arenaSize += alignment + BLK_SIZE(MIN_PAYLOAD_SIZE); }
+    if (arenaSize < (size_t) SHRD_ARENA_SIZE) { arenaSize = SHRD_ARENA_SIZE; }
+    arena = allocateFrom(arenaSize, &LIB_MEM_PART);
+    if (!arena) { return NULL; }
+    createPartition(&(arena->partition), arena + 1, arenaSize - sizeof(struct sharedArena));
+    arena->next = SHRD_ARENAS;
+    SHRD_ARENAS = arena;
+    return allocateAlignedFrom(size, alignment, &(arena->partition));
+}
 
-    // Doesn't split the found block if splitting would waste space
-    if ((size + DBL_BLK_META_SIZE) >= head->payloadSize) {
-        setBlockUsed(head, 1);
-        return head + 1;
+// Returns the partition of the shared memory partition or shared
+// arena ptr is in, or NULL if ptr isn't shared memory
+struct memoryPartition * getSharedPartition(void * ptr) {
+    if (isInPartition(ptr, &SHRD_MEM_PART)) { return &SHRD_MEM_PART; }
+    struct sharedArena * arena;
+    for (arena = SHRD_ARENAS; arena; arena = arena->next) {
+        if (isInPartition(ptr, &(arena->partition))) { return &(arena->partition); }
     }
+    return NULL;
+}
 
-    // Splits the found block
-    size_t nextPayloadSize = head->payloadSize - (size + DBL_BLK_META_SIZE);
-    setBlockMetadata(head, 1, size);
-    setBlockMetadata(getTail(head) + 1, 0, nextPayloadSize);
+// Frees ptr's shared block to the running thread's magazines if
+// blocks its size are cached, else to its partition. Does nothing
+// if ptr isn't shared memory.
+void freeShared(void * ptr) {
+    if (getSharedPartition(ptr) && !cacheShared(ptr)) { deallocateShared(ptr); }
+}
 
-    return head + 1;
+// Resizes ptr's shared allocation to size bytes, in place if its
+// block can grow or shrink, else by moving it. Returns NULL and
+// leaves ptr alone if ptr isn't shared memory or there's no room.
+void * reallocateShared(void * ptr, size_t size) {
+    struct memoryPartition * partition = getSharedPartition(ptr);
+    if (!partition) { return NULL; }
+    if (resizeIn(ptr, size, partition)) { return ptr; }
+    size_t oldSize = (BLK_META_PTR(ptr) - 1)->payloadSize;
+    void * ret = allocateShared(size, 0);
+    if (!ret) { return NULL; }
+    memcpy(ret, ptr, oldSize < size ? oldSize : size);
+    freeShared(ptr);
+    return ret;
+}
+
+// Allocates size bytes aligned to alignment as the running thread.
+// Large allocations get their own run of pages unless they need
+// more alignment than a run gives. Otherwise allocate from the
+// thread's partition, extending it if needed. Returns NULL if
+// there's no room.
+void * allocateThread(size_t size, size_t alignment) {
+    if (size >= THRD_MEM->largeAllocSize && alignment <= BLK_META_SIZE) { return allocateRun(size); }
+    void * ret = allocateAlignedFrom(size, alignment, &THRD_MEM_PART);
+    if (!ret && extendThreadPartition(alignment > BLK_META_SIZE ? size + alignment + BLK_SIZE(MIN_PAYLOAD_SIZE) : size)) {
+        ret = allocateAlignedFrom(size, alignment, &THRD_MEM_PART);
+    }
+    return ret;
+}
+
+// Frees ptr as the running thread from its partition, trimming
+// the partition after, from its runs, or from shared memory
+void deallocateThread(void * ptr) {
+    if (deallocateFrom(ptr, &THRD_MEM_PART)) {
+        trimThreadPartition();
+    } else if (!deallocateRun(ptr)) {
+        freeShared(ptr);
+    }
+}
+
+// Resizes the running thread's run holding ptr to hold size bytes
+// without moving it, growing into the gap above it or giving back
+// the pages it no longer needs. Returns 0 if it can't be resized
+// else returns 1.
+int resizeRun(void * ptr, size_t size) {
+    struct largeRun * run = RUN_PTR(ptr);
+    size_t numPages = ALIGN_PAGE(size + RUN_HEADER_SIZE) / pageSize;
+    if (numPages > run->numPages) {
+        char * gapEnd = run->next ? CHAR_PTR(run->next) : THRD_MEM_END;
+        if (CHAR_PTR(run) + (numPages * pageSize) > gapEnd || !canExtend(currentTcb, numPages - run->numPages)) { return 0; }
+    }
+    unsigned long firstPage = (CHAR_PTR(run) - MEM_PGS) / pageSize;
+    unsigned long pageNumber;
+    for (pageNumber = firstPage + run->numPages; pageNumber > firstPage + numPages; pageNumber--) {
+        releasePage(currentTcb, pageNumber - 1);
+    }
+    run->numPages = numPages;
+    return 1;
+}
+
+// Resizes ptr's allocation to size bytes as the running thread, in
+// place if its block or run can grow or shrink, else by moving it.
+// The partition's last block grows by extending the partition.
+// Returns NULL and leaves ptr alone if there's no room.
+void * reallocateThread(void * ptr, size_t size) {
+    size_t oldSize;
+    struct memoryPartition * partition = &THRD_MEM_PART;
+    if (isInPartition(ptr, partition)) {
+        struct blockMetadata * head = BLK_META_PTR(ptr) - 1;
+        struct blockMetadata * tail = getTail(head);
+        int isLast = tail == partition->lastTail || (!(tail + 1)->used && getTail(tail + 1) == partition->lastTail);
+        if (resizeIn(ptr, size, partition) || (isLast && extendThreadPartition(size - head->payloadSize) && resizeIn(ptr, size, partition))) {
+            trimThreadPartition();
+            return ptr;
+        }
+        oldSize = head->payloadSize;
+    } else if (CHAR_PTR(ptr) >= getRunsStart() && CHAR_PTR(ptr) < THRD_MEM_END) {
+        if (resizeRun(ptr, size)) { return ptr; }
+        oldSize = (RUN_PTR(ptr)->numPages * pageSize) - RUN_HEADER_SIZE;
+    } else { return reallocateShared(ptr, size); }
+
+    void * ret = allocateThread(size, 0);
+    if (!ret) { return NULL; }
+    memcpy(ret, ptr, oldSize < size ? oldSize : size);
+    deallocateThread(ptr);
+    return ret;
+}
+
+// Zeroes size bytes at ptr in the running thread's pages, skipping
+// the pages the thread hasn't been given yet since those are zeroed
+// when they're first touched
+void zeroThreadMemory(void * ptr, size_t size) {
+    char * start = CHAR_PTR(ptr);
+    char * end = start + size;
+    while (start < end) {
+        unsigned long pageNumber = (start - MEM_PGS) / pageSize;
+        char * pageEnd = MEM_PGS + ((pageNumber + 1) * pageSize);
+        if (pageEnd > end) { pageEnd = end; }
+        if (findPage(currentTcb, pageNumber)) { memset(start, 0, pageEnd - start); }
+        start = pageEnd;
+    }
 }
 
 // Allocates size bytes from the approprite partition and returns a pointer
-// to the allocation. Returns NULL if no space or on bad request.
+// to the allocation. Thread allocations are recorded by the heap profiler
+// as coming from fileName and lineNumber. Returns NULL if no space, size
+// is 0 for a thread, or on bad request.
 void * myallocate(size_t size, char * fileName, int lineNumber, int request) {
 
     // Initialize the memory manager
@@ -473,21 +2083,108 @@ void * myallocate(size_t size, char * fileName, int lineNumber, int request) {
 
     // Allocate from thread address space
     } else if (request == THREADREQ) {
+        initializeThreads();
+        if (!size) { return NULL; }
 
         // Block scheduler for thread safety
+        char previousBlock = block;
         block = 1;
+        void * ret = allocateThread(size, 0);
+        if (ret && HEAP_PROFILE) { profileAllocation(ret, size, fileName, lineNumber); }
+
+        // Restore the scheduler's block and return
+        block = previousBlock;
+        return ret;        
+
+    } else { return NULL; }
+}
+
+// Resizes ptr's allocation from the approprite partition to size bytes,
+// keeping its contents up to the smaller size. Grows or shrinks in place
+// when it can. Acts like myallocate() if ptr is NULL and frees ptr if size
+// is 0. Returns NULL and leaves ptr alone if no space or on bad request.
+void * myreallocate(void * ptr, size_t size, char * fileName, int lineNumber, int request) {
+    if (!ptr) { return myallocate(size, fileName, lineNumber, request); }
+    if (!size) {
+        mydeallocate(ptr, fileName, lineNumber, request);
+        return NULL;
+    }
 
-        // If needed and possible, extend the thread's partition.
-        // Allocate from the thread's partition.
-        void * ret = allocateFrom(size, &(THRD_MEM->partition));
-        while (!ret && canExtend(currentTcb)) {
-            extendPartition(&(THRD_MEM->partition), pageSize);
-            ret = allocateFrom(size, &(THRD_MEM->partition));
+    // Reallocate in the thread library's partition
+    if (request == LIBRARYREQ) {
+        if (resizeIn(ptr, size, &LIB_MEM_PART)) { return ptr; }
+        void * ret = allocateFrom(size, &LIB_MEM_PART);
+        if (!ret) { return NULL; }
+        size_t oldSize = (BLK_META_PTR(ptr) - 1)->payloadSize;
+        memcpy(ret, ptr, oldSize < size ? oldSize : size);
+        deallocateFrom(ptr, &LIB_MEM_PART);
+        return ret;
+
+    // Reallocate as a thread, recording it like a free and an allocation
+    } else if (request == THREADREQ) {
+        initializeThreads();
+        char previousBlock = block;
+        block = 1;
+        void * ret = reallocateThread(ptr, size);
+        if (ret && HEAP_PROFILE) {
+            profileFree(ptr);
+            profileAllocation(ret, size, fileName, lineNumber);
         }
+        block = previousBlock;
+        return ret;
 
-        // Unblock the scheduler and return
-        block = 0;
-        return ret;        
+    } else { return NULL; }
+}
+
+// Allocates count elements of size bytes set to zero from the approprite
+// partition. Returns NULL if no space, either is 0, the total overflows,
+// or on bad request.
+void * mycallocate(size_t count, size_t size, char * fileName, int lineNumber, int request) {
+    initializeMemory();
+    if (!count || !size || count > SIZE_MAX / size) { return NULL; }
+
+    // Allocate and clear from the thread library's partition
+    if (request == LIBRARYREQ) {
+        void * ret = allocateFrom(count * size, &LIB_MEM_PART);
+        if (ret) { memset(ret, 0, count * size); }
+        return ret;
+
+    // Allocate as a thread, only clearing pages it already has
+    } else if (request == THREADREQ) {
+        initializeThreads();
+        char previousBlock = block;
+        block = 1;
+        void * ret = allocateThread(count * size, 0);
+        if (ret) {
+            zeroThreadMemory(ret, count * size);
+            if (HEAP_PROFILE) { profileAllocation(ret, count * size, fileName, lineNumber); }
+        }
+        block = previousBlock;
+        return ret;
+
+    } else { return NULL; }
+}
+
+// Allocates size bytes aligned to alignment from the approprite partition.
+// Returns NULL if no space, size is 0, alignment isn't a power of two, or
+// on bad request.
+void * myalignedallocate(size_t alignment, size_t size, char * fileName, int lineNumber, int request) {
+    initializeMemory();
+    if (!size || !alignment || (alignment & (alignment - 1)) || size > SIZE_MAX - alignment - pageSize) { return NULL; }
+
+    // Allocate from the thread library's partition
+    if (request == LIBRARYREQ) {
+        return allocateAlignedFrom(size, alignment, &LIB_MEM_PART);
+
+    // Allocate as a thread
+    } else if (request == THREADREQ) {
+        initializeThreads();
+        char previousBlock = block;
+        block = 1;
+        void * ret = allocateThread(size, alignment);
+        if (ret && HEAP_PROFILE) { profileAllocation(ret, size, fileName, lineNumber); }
+        block = previousBlock;
+        return ret;
 
     } else { return NULL; }
 }
@@ -495,9 +2192,7 @@ void * myallocate(size_t size, char * fileName, int lineNumber, int request) {
 // Allocates size bytes from memory as a thread.
 // Returns NULL if no space of size is 0.
 void * threadAllocate(size_t size) {
-    initializeThreads();
-    if (!size) { return NULL; }
-    return myallocate(size, __FILE__, __LINE__, THREADREQ);
+    return myallocate(size, NULL, 0, THREADREQ);
 }
 
 // Returns a pointer of size bytes from shared
@@ -505,47 +2200,152 @@ void * threadAllocate(size_t size) {
 void * shalloc(size_t size) {
     initializeMemory();
     if (!size) { return NULL; }
+    char previousBlock = block;
     block = 1;
-    void * ret = allocateFrom(size, &SHRD_MEM_PART);
-    block = 0;
+    void * ret = allocateShared(size, 0);
+    block = previousBlock;
     return ret;
 }
 
-// Deallocates ptr's block from partition. If ptr is not
-// in partition return 0, else return 1. Undefined behavior
-// if ptr isn't a pointer previously returned.
-int deallocateFrom(void * ptr, struct memoryPartition * partition) {
+// Resizes ptr's allocation to size bytes as a thread, keeping its
+// contents up to the smaller size. Grows or shrinks in place when
+// it can. Acts like threadAllocate() if ptr is NULL and frees ptr
+// if size is 0. Returns NULL and leaves ptr alone if no space.
+void * threadReallocate(void * ptr, size_t size) {
+    return myreallocate(ptr, size, NULL, 0, THREADREQ);
+}
 
-    // Check if ptr is in partition
-    if (ptr >= VOID_PTR(partition->firstHead + 1) && ptr < VOID_PTR(partition->lastTail)) {
+// Allocates count elements of size bytes set to zero as a thread.
+// Returns NULL if no space, either is 0, or the total overflows.
+void * threadCallocate(size_t count, size_t size) {
+    return mycallocate(count, size, NULL, 0, THREADREQ);
+}
 
-        // Get head and tail from ptr
-        struct blockMetadata * head = BLK_META_PTR(ptr) - 1;
-        struct blockMetadata * tail = getTail(head);
-        
-        // Coallese with neihboring blocks
-        if (head != partition->firstHead) {
-            struct blockMetadata * previousTail = head - 1;
-            if (previousTail->used == 0) {
-                size_t newPayloadSize = head->payloadSize + previousTail->payloadSize + DBL_BLK_META_SIZE;
-                head = getHead(previousTail);
-                setBlockPayloadSize(head, newPayloadSize);
-            }
-        }
-        if (tail != partition->lastTail) {
-            struct blockMetadata * nextHead = tail + 1;
-            if (nextHead->used == 0) {
-                size_t newPayloadSize = tail->payloadSize + nextHead->payloadSize + DBL_BLK_META_SIZE;
-                tail = getTail(nextHead);
-                setBlockPayloadSize(head, newPayloadSize);
-            }
+// Allocates size bytes aligned to alignment as a thread. Returns
+// NULL if no space, size is 0, or alignment isn't a power of two.
+void * threadAlignedAllocate(size_t alignment, size_t size) {
+    return myalignedallocate(alignment, size, NULL, 0, THREADREQ);
+}
+
+// Resizes ptr's shared allocation to size bytes, keeping its contents
+// up to the smaller size. Grows or shrinks in place when it can. Acts
+// like shalloc() if ptr is NULL and frees ptr if size is 0. Returns
+// NULL and leaves ptr alone if no space.
+void * shrealloc(void * ptr, size_t size) {
+    initializeMemory();
+    if (!ptr) { return shalloc(size); }
+    char previousBlock = block;
+    block = 1;
+    void * ret = NULL;
+    if (size) { ret = reallocateShared(ptr, size); }
+    else { freeShared(ptr); }
+    block = previousBlock;
+    return ret;
+}
+
+// Allocates count elements of size bytes set to zero from shared
+// memory. Returns NULL if no space, either is 0, or the total
+// overflows.
+void * shcalloc(size_t count, size_t size) {
+    initializeMemory();
+    if (!count || !size || count > SIZE_MAX / size) { return NULL; }
+    void * ret = shalloc(count * size);
+    if (ret) { memset(ret, 0, count * size); }
+    return ret;
+}
+
+// Allocates size bytes aligned to alignment from shared memory. Returns
+// NULL if no space, size is 0, or alignment isn't a power of two.
+void * shalignedalloc(size_t alignment, size_t size) {
+    initializeMemory();
+    if (!size || !alignment || (alignment & (alignment - 1)) || size > SIZE_MAX - alignment - pageSize) { return NULL; }
+    char previousBlock = block;
+    block = 1;
+    void * ret = allocateShared(size, alignment);
+    block = previousBlock;
+    return ret;
+}
+
+// Adds partition's size, free space and counters to stats
+void addPartitionStats(struct memoryPartition * partition, struct partitionStats * stats) {
+    stats->size += CHAR_PTR(partition->lastTail + 1) - CHAR_PTR(partition->firstHead);
+    stats->freeBytes += partition->freeBytes;
+    stats->freeBlocks += partition->numFreeBlocks;
+    stats->allocations += partition->allocations;
+    stats->deallocations += partition->deallocations;
+
+    // The largest free block is in the biggest non-empty free list
+    int sizeClass = NUM_SIZE_CLASSES - 1;
+    while (sizeClass >= 0 && !partition->freeLists[sizeClass]) { sizeClass--; }
+    if (sizeClass < 0) { return; }
+    struct blockMetadata * head;
+    for (head = partition->freeLists[sizeClass]; head; head = FREE_LINKS_PTR(head)->next) {
+        if (head->payloadSize > stats->largestFreeBlock) { stats->largestFreeBlock = head->payloadSize; }
+    }
+}
+
+// Stores a snapshot of the memory manager's counters, page use
+// and partitions in stats
+void getMemoryStats(struct memoryStats * stats) {
+    initializeMemory();
+    char previousBlock = block;
+    block = 1;
+    *stats = STATS;
+
+    // Counting the pages threads own and the compressed pool's pages
+    stats->memoryPages = NUM_MEM_PGS;
+    stats->swapPages = NUM_SWAP_PGS;
+    unsigned long i;
+    for (i = 0; i < NUM_PGS; i++) {
+        struct pageTableRow * row = PG_TBL + i;
+        if (row->thread && i < NUM_MEM_PGS) { stats->usedMemoryPages++; }
+        else if (row->thread) { stats->usedSwapPages++; }
+        if (row->compressedLocation) {
+            stats->compressedPages++;
+            stats->compressedBytes += row->compressedSize;
         }
+    }
+
+    // Adding up the partitions, with shared memory's arenas
+    addPartitionStats(&LIB_MEM_PART, &(stats->libraryMemory));
+    addPartitionStats(&SHRD_MEM_PART, &(stats->sharedMemory));
+    struct sharedArena * arena;
+    for (arena = SHRD_ARENAS; arena; arena = arena->next) {
+        addPartitionStats(&(arena->partition), &(stats->sharedMemory));
+        stats->sharedArenas++;
+    }
+    if (CMPRS_BUF) { addPartitionStats(&CMPRS_MEM_PART, &(stats->compressedPool)); }
+    block = previousBlock;
+}
 
-        // Free
-        setBlockUsed(head, 0);
-        return 1;
+// Stores a snapshot of where thread's pages are in stats, or the
+// calling thread's if thread is NULL. The partition and runs are
+// only filled in for the calling thread since the rest of a
+// thread's memory can't be read while it isn't running.
+void getThreadMemoryStats(void * thread, struct threadMemoryStats * stats) {
+    initializeThreads();
+    memset(stats, 0, sizeof(struct threadMemoryStats));
+    tcb * target = thread ? (tcb *) thread : currentTcb;
+    char previousBlock = block;
+    block = 1;
+
+    // Walking the thread's own list of pages
+    stats->pages = target->numPages;
+    struct pageTableRow * row;
+    for (row = target->pages; row; row = row->ownerNext) {
+        if (isResident(row)) { stats->residentPages++; }
+        else if (row->physicalLocation) { stats->displacedPages++; }
+        else if (row->compressedLocation) { stats->compressedPages++; }
+        else { stats->swappedPages++; }
+    }
 
-    } else { return 0; }
+    // The calling thread's partition and runs
+    if (target == currentTcb && target->numPages) {
+        addPartitionStats(&THRD_MEM_PART, &(stats->partition));
+        struct largeRun * run;
+        for (run = THRD_MEM->runs; run; run = run->next) { stats->runPages += run->numPages; }
+    }
+    block = previousBlock;
 }
 
 // Frees memory refrenced by ptr that was previously allocated with
@@ -557,12 +2357,12 @@ void mydeallocate(void * ptr, char * fileName, int lineNumber, int request) {
     if (request == LIBRARYREQ) { deallocateFrom(ptr, &LIB_MEM_PART); }
 
     // Deallocate from thread partition or shared partition in a thread-safe manor
-    else if (request == THREADREQ) {
+    else if (request == THREADREQ && ptr) {
+        char previousBlock = block;
         block = 1;
-        if (!deallocateFrom(ptr, &(THRD_MEM->partition))) {
-            deallocateFrom(ptr, &SHRD_MEM_PART);
-        }
-        block = 0;
+        if (HEAP_PROFILE) { profileFree(ptr); }
+        deallocateThread(ptr);
+        block = previousBlock;
     }
 }
 
@@ -571,5 +2371,5 @@ void mydeallocate(void * ptr, char * fileName, int lineNumber, int request) {
 // if ptr was already freed or if ptr wasn't retrned by
 // an allocating fucntion. Does nothing is ptr is NULL.
 void threadDeallocate(void * ptr) {
-    if (ptr) { mydeallocate(ptr, __FILE__, __LINE__, THREADREQ); }
+    mydeallocate(ptr, NULL, 0, THREADREQ);
 }
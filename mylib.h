@@ -6,11 +6,98 @@
 #define THREADREQ 1
 #define LIBRARYREQ 0
 
-#define malloc(size) threadAllocate(size)
-#define free(ptr) threadDeallocate(ptr)
+// The macros pass their call site on for the heap profiler
+#define malloc(size) myallocate(size, __FILE__, __LINE__, THREADREQ)
+#define free(ptr) mydeallocate(ptr, __FILE__, __LINE__, THREADREQ)
+#define realloc(ptr, size) myreallocate(ptr, size, __FILE__, __LINE__, THREADREQ)
+#define calloc(count, size) mycallocate(count, size, __FILE__, __LINE__, THREADREQ)
+#define aligned_alloc(alignment, size) myalignedallocate(alignment, size, __FILE__, __LINE__, THREADREQ)
+
+// Size, free space and counters of a partition
+struct partitionStats {
+    // Bytes the partition spans
+    size_t size;
+    // Bytes in free blocks' payloads and the number of free blocks
+    size_t freeBytes;
+    size_t freeBlocks;
+    // Payload size of the largest free block
+    size_t largestFreeBlock;
+    // Blocks allocated from and freed to the partition
+    unsigned long allocations;
+    unsigned long deallocations;
+};
+
+// Counters kept by the memory manager
+struct memoryStats {
+    // Faults on protected memory pages
+    unsigned long faults;
+    // Pages read from swapFile
+    unsigned long swapIns;
+    // Pages written to swapFile
+    unsigned long swapOuts;
+    // Pages evicted from memory to make room for a page in swapFile
+    unsigned long evictions;
+    // Calls writing buffered pages to swapFile
+    unsigned long swapFileWrites;
+    // Pages compressed into the compressed pool instead of swapFile
+    unsigned long compressedOuts;
+    // Pages decompressed from the compressed pool
+    unsigned long compressedIns;
+    // Pages given back by trimmed thread partitions and exited threads
+    unsigned long releasedPages;
+    // Total and longest time spent resolving faults in nanoseconds
+    unsigned long faultNanoseconds;
+    unsigned long maxFaultNanoseconds;
+    // Memory pages and swapFile pages, and how many of each threads own
+    size_t memoryPages;
+    size_t swapPages;
+    size_t usedMemoryPages;
+    size_t usedSwapPages;
+    // Pages in the compressed pool and the bytes they take there
+    size_t compressedPages;
+    size_t compressedBytes;
+    // The thread library's partition, shared memory with all of its
+    // arenas, the number of arenas, and the compressed pool
+    struct partitionStats libraryMemory;
+    struct partitionStats sharedMemory;
+    size_t sharedArenas;
+    struct partitionStats compressedPool;
+};
+
+// Where a thread's pages are and the state of its memory
+struct threadMemoryStats {
+    // Pages the thread owns
+    size_t pages;
+    // Its pages in the memory page of the same number, which it can
+    // use, and the ones in other memory pages
+    size_t residentPages;
+    size_t displacedPages;
+    // Its pages in the compressed pool and in swapFile
+    size_t compressedPages;
+    size_t swappedPages;
+    // Its partition and the pages of its large allocation runs, only
+    // filled in for the calling thread
+    struct partitionStats partition;
+    size_t runPages;
+};
 
 void * threadAllocate(size_t size);
 void * shalloc(size_t size);
 void threadDeallocate(void * ptr);
+void * threadReallocate(void * ptr, size_t size);
+void * threadCallocate(size_t count, size_t size);
+void * threadAlignedAllocate(size_t alignment, size_t size);
+void * shrealloc(void * ptr, size_t size);
+void * shcalloc(size_t count, size_t size);
+void * shalignedalloc(size_t alignment, size_t size);
+void getMemoryStats(struct memoryStats * stats);
+void getThreadMemoryStats(void * thread, struct threadMemoryStats * stats);
+void dumpHeapProfile(void);
+
+void * myallocate(size_t size, char * fileName, int lineNumber, int request);
+void mydeallocate(void * ptr, char * fileName, int lineNumber, int request);
+void * myreallocate(void * ptr, size_t size, char * fileName, int lineNumber, int request);
+void * mycallocate(size_t count, size_t size, char * fileName, int lineNumber, int request);
+void * myalignedallocate(size_t alignment, size_t size, char * fileName, int lineNumber, int request);
 
 #endif
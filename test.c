@@ -1,4 +1,9 @@
 #include "my_pthread_t.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 void * test(void * nun) {
     char * some = shalloc(40);
@@ -20,6 +25,706 @@ void * test2(void * nun) {
     pthread_exit(some);
 }
 
+// Set when a check fails
+int failed = 0;
+
+// Prints whether a check passed
+void check(char * name, int passed) {
+    printf("%s: %s\n", name, passed ? "ok" : "FAILED");
+    fflush(stdout);
+    if (!passed) { failed = 1; }
+}
+
+// A block deep in a free list is found when the blocks ahead of it
+// are too small and there's nothing in the bigger lists
+#define NUM_SMALL_BLOCKS 20
+#define MAX_FILL_BLOCKS 256
+
+void testFreeLists() {
+    void * small[NUM_SMALL_BLOCKS];
+    void * guards[NUM_SMALL_BLOCKS + 1];
+    void * fill[MAX_FILL_BLOCKS];
+    int i, numFill = 0;
+    for (i = 0; i < NUM_SMALL_BLOCKS; i++) {
+        small[i] = myallocate(64, NULL, 0, LIBRARYREQ);
+        guards[i] = myallocate(16, NULL, 0, LIBRARYREQ);
+    }
+    void * deep = myallocate(112, NULL, 0, LIBRARYREQ);
+    guards[NUM_SMALL_BLOCKS] = myallocate(16, NULL, 0, LIBRARYREQ);
+
+    // Using up the rest of the library's partition, then freeing
+    // the deep block before the small ones so they're ahead of it
+    size_t size = 8 * 1024 * 1024;
+    while (size >= 16 && numFill < MAX_FILL_BLOCKS) {
+        void * ptr = myallocate(size, NULL, 0, LIBRARYREQ);
+        if (ptr) { fill[numFill++] = ptr; }
+        else { size /= 2; }
+    }
+    mydeallocate(deep, NULL, 0, LIBRARYREQ);
+    for (i = 0; i < NUM_SMALL_BLOCKS; i++) { mydeallocate(small[i], NULL, 0, LIBRARYREQ); }
+    void * found = myallocate(112, NULL, 0, LIBRARYREQ);
+    check("free list search", found != NULL);
+
+    mydeallocate(found, NULL, 0, LIBRARYREQ);
+    for (i = 0; i <= NUM_SMALL_BLOCKS; i++) { mydeallocate(guards[i], NULL, 0, LIBRARYREQ); }
+    for (i = 0; i < numFill; i++) { mydeallocate(fill[i], NULL, 0, LIBRARYREQ); }
+}
+
+// Pages keep their contents while threads using more pages than
+// fit in memory push each other's pages out and fault them back
+#define NUM_SWAP_THREADS 4
+#define NUM_SWAP_PAGES 400
+#define SWAP_PAGE_SIZE 4096
+#define NUM_SWAP_ROUNDS 2
+
+int swapCorrupted = 0;
+
+// Fills or checks buf with bytes that depend on id and the page,
+// random on odd pages and repeating on even ones. Returns 1 if
+// checking found a wrong byte, else 0.
+int swapPattern(char * buf, long id, int fill) {
+    unsigned long state = id + 1;
+    size_t i;
+    for (i = 0; i < NUM_SWAP_PAGES * SWAP_PAGE_SIZE; i++) {
+        char expected = (char) (id + i);
+        if ((i / SWAP_PAGE_SIZE) % 2) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            expected = (char) state;
+        }
+        if (fill) { buf[i] = expected; }
+        else if (buf[i] != expected) { return 1; }
+    }
+    return 0;
+}
+
+void * swapWorker(void * id) {
+    char * buf = malloc(NUM_SWAP_PAGES * SWAP_PAGE_SIZE);
+    if (!buf) {
+        swapCorrupted = 1;
+        return NULL;
+    }
+    swapPattern(buf, (long) id, 1);
+    int round;
+    for (round = 0; round < NUM_SWAP_ROUNDS; round++) {
+        my_pthread_yield();
+        if (swapPattern(buf, (long) id, 0)) { swapCorrupted = 1; }
+    }
+    free(buf);
+    return NULL;
+}
+
+// Runs the swap workers and returns 1 if their pages kept their contents
+int runSwapWorkers() {
+    pthread_t threads[NUM_SWAP_THREADS];
+    long i;
+    swapCorrupted = 0;
+    for (i = 0; i < NUM_SWAP_THREADS; i++) { pthread_create(&threads[i], NULL, swapWorker, (void *) i); }
+    for (i = 0; i < NUM_SWAP_THREADS; i++) { pthread_join(threads[i], NULL); }
+    return !swapCorrupted;
+}
+
+void testSwap() {
+    check("swap round trip", runSwapWorkers());
+}
+
+// Swapping shows up in the memory manager's counters
+void testSwapCounters() {
+    struct memoryStats before, after;
+    getMemoryStats(&before);
+    runSwapWorkers();
+    getMemoryStats(&after);
+    check("fault counter", after.faults > before.faults);
+    check("eviction counter", after.evictions > before.evictions);
+    check("swap counters", after.swapOuts > before.swapOuts && after.swapIns > before.swapIns);
+}
+
+// Pages that compress well go through the compressed pool and
+// the rest still go through swapFile
+void testCompression() {
+    struct memoryStats before, after;
+    getMemoryStats(&before);
+    int passed = runSwapWorkers();
+    getMemoryStats(&after);
+    check("compressed round trip", passed && after.compressedOuts > before.compressedOuts && after.compressedIns > before.compressedIns);
+    check("incompressible pages swapped", after.swapOuts > before.swapOuts);
+}
+
+// An exiting thread gives back the pages it never freed
+#define NUM_EXIT_PAGES 50
+
+void * leaker(void * arg) {
+    char * buf = malloc(NUM_EXIT_PAGES * 4096);
+    if (buf) { memset(buf, 1, NUM_EXIT_PAGES * 4096); }
+    return buf;
+}
+
+void testExitReclaim() {
+    struct memoryStats before, after;
+    pthread_t thread;
+    void * ret;
+    getMemoryStats(&before);
+    pthread_create(&thread, NULL, leaker, NULL);
+    pthread_join(thread, &ret);
+    getMemoryStats(&after);
+    check("pages released on exit", ret && after.releasedPages >= before.releasedPages + NUM_EXIT_PAGES);
+}
+
+// Shared memory grows past its first pages and other threads
+// see what was written there
+#define NUM_SHARED_BLOCKS 64
+#define SHARED_BLOCK_SIZE 1000
+
+char * sharedBlocks[NUM_SHARED_BLOCKS];
+
+void * sharedReader(void * arg) {
+    int i, j;
+    for (i = 0; i < NUM_SHARED_BLOCKS; i++) {
+        for (j = 0; j < SHARED_BLOCK_SIZE; j++) {
+            if (sharedBlocks[i][j] != (char) (i + j)) { return (void *) 1; }
+        }
+    }
+    return NULL;
+}
+
+void testSharedArenas() {
+    int i, j, allocated = 1;
+    for (i = 0; i < NUM_SHARED_BLOCKS; i++) {
+        sharedBlocks[i] = shalloc(SHARED_BLOCK_SIZE);
+        if (!sharedBlocks[i]) {
+            allocated = 0;
+            break;
+        }
+        for (j = 0; j < SHARED_BLOCK_SIZE; j++) { sharedBlocks[i][j] = (char) (i + j); }
+    }
+    check("shared memory grows", allocated);
+    if (!allocated) { return; }
+    pthread_t reader;
+    void * ret;
+    pthread_create(&reader, NULL, sharedReader, NULL);
+    pthread_join(reader, &ret);
+    check("shared memory contents", ret == NULL);
+    for (i = 0; i < NUM_SHARED_BLOCKS; i++) { free(sharedBlocks[i]); }
+}
+
+// Allocations bigger than the thread's partition get their own run
+// of pages, keep their contents and leave room for more once freed
+#define LARGE_SIZE (2 * 1024 * 1024)
+
+void * largeWorker(void * arg) {
+    int round;
+    for (round = 0; round < 2; round++) {
+        char * buf = malloc(LARGE_SIZE);
+        if (!buf) { return (void *) 1; }
+        size_t i;
+        for (i = 0; i < LARGE_SIZE; i += 512) { buf[i] = (char) (i / 512 + round); }
+        for (i = 0; i < LARGE_SIZE; i += 512) {
+            if (buf[i] != (char) (i / 512 + round)) { return (void *) 1; }
+        }
+        free(buf);
+    }
+    return NULL;
+}
+
+void testLargeRuns() {
+    pthread_t thread;
+    void * ret;
+    pthread_create(&thread, NULL, largeWorker, NULL);
+    pthread_join(thread, &ret);
+    check("large allocation", ret == NULL);
+}
+
+// Resized blocks keep their contents, growing in place when the
+// space after them is free, cleared blocks are zero, and aligned
+// blocks are aligned, for threads and shared memory
+void * reallocWorker(void * arg) {
+    int passed = 1;
+    char * buf = malloc(100);
+    memset(buf, 7, 100);
+    char * grown = realloc(buf, 200);
+    passed = passed && grown == buf && grown[0] == 7 && grown[99] == 7;
+    char * moved = realloc(grown, 64 * 1024);
+    passed = passed && moved && moved[0] == 7 && moved[99] == 7;
+    free(moved);
+    check("realloc", passed);
+
+    int * zeroed = calloc(1000, sizeof(int));
+    int i;
+    passed = zeroed != NULL;
+    for (i = 0; passed && i < 1000; i++) { passed = zeroed[i] == 0; }
+    free(zeroed);
+    check("calloc", passed);
+
+    size_t alignment;
+    passed = 1;
+    for (alignment = 16; alignment <= 8192; alignment *= 2) {
+        char * aligned = aligned_alloc(alignment, 100);
+        passed = passed && aligned && (unsigned long) aligned % alignment == 0;
+        free(aligned);
+    }
+    check("aligned_alloc", passed);
+    return NULL;
+}
+
+void testReallocation() {
+    pthread_t thread;
+    pthread_create(&thread, NULL, reallocWorker, NULL);
+    pthread_join(thread, NULL);
+
+    char * buf = shalloc(100);
+    memset(buf, 9, 100);
+    char * grown = shrealloc(buf, 300);
+    check("shrealloc", grown && grown[0] == 9 && grown[99] == 9);
+    shrealloc(grown, 0);
+
+    char * zeroed = shcalloc(100, 10);
+    int i, passed = zeroed != NULL;
+    for (i = 0; passed && i < 1000; i++) { passed = zeroed[i] == 0; }
+    check("shcalloc", passed);
+    free(zeroed);
+
+    char * aligned = shalignedalloc(256, 100);
+    check("shalignedalloc", aligned && (unsigned long) aligned % 256 == 0);
+    free(aligned);
+}
+
+// A small shared block freed by a thread is handed back to that
+// thread's next request of the same size
+void testMagazines() {
+    char * first = shalloc(48);
+    free(first);
+    char * second = shalloc(48);
+    check("magazine reuse", first && second == first);
+    free(second);
+}
+
+// The memory stats count known allocations and a thread's pages
+#define NUM_STATS_PAGES 20
+#define NUM_STATS_BLOCKS 5
+
+void * statsWorker(void * arg) {
+    struct threadMemoryStats stats;
+    char * buf = malloc(NUM_STATS_PAGES * 4096);
+    if (buf) { memset(buf, 1, NUM_STATS_PAGES * 4096); }
+    getThreadMemoryStats(NULL, &stats);
+    check("thread pages", buf && stats.pages >= NUM_STATS_PAGES && stats.residentPages > 0);
+    check("thread page placement", stats.residentPages + stats.displacedPages + stats.compressedPages + stats.swappedPages == stats.pages);
+    check("thread partition", stats.partition.size > 0);
+    free(buf);
+    return NULL;
+}
+
+void testMemoryStats() {
+    struct memoryStats before, after;
+    void * blocks[NUM_STATS_BLOCKS];
+    int i;
+    getMemoryStats(&before);
+    for (i = 0; i < NUM_STATS_BLOCKS; i++) { blocks[i] = shalloc(1000); }
+    void * library = myallocate(100, NULL, 0, LIBRARYREQ);
+    getMemoryStats(&after);
+    check("shared allocations", after.sharedMemory.allocations == before.sharedMemory.allocations + NUM_STATS_BLOCKS);
+    check("library allocations", after.libraryMemory.allocations > before.libraryMemory.allocations);
+    check("page counts", after.usedMemoryPages <= after.memoryPages && after.usedSwapPages <= after.swapPages);
+    for (i = 0; i < NUM_STATS_BLOCKS; i++) { free(blocks[i]); }
+    mydeallocate(library, NULL, 0, LIBRARYREQ);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, statsWorker, NULL);
+    pthread_join(thread, NULL);
+}
+
+// Threads waiting on a semaphore take its units in the order they waited
+sem_t sem;
+int numSemWaiters = 0;
+int numSemWoken = 0;
+int semOrder[3];
+
+void * semWaiter(void * id) {
+    numSemWaiters++;
+    sem_wait(&sem);
+    semOrder[numSemWoken++] = (long) id;
+    return NULL;
+}
+
+void testSemaphore() {
+    pthread_t threads[3];
+    long i;
+    sem_init(&sem, 0, 0);
+    for (i = 0; i < 3; i++) {
+        pthread_create(&threads[i], NULL, semWaiter, (void *) i);
+        while (numSemWaiters <= i) { my_pthread_yield(); }
+    }
+
+    // A post hands its unit to the first waiter so it can't be taken back
+    sem_post(&sem);
+    int handedOff = sem_trywait(&sem) == -1 && errno == EAGAIN;
+    check("semaphore destroy with waiters", sem_destroy(&sem) == -1 && errno == EBUSY);
+
+    // Woken threads may run in any order, so post one unit at a time
+    for (i = 1; i < 3; i++) {
+        while (numSemWoken < i) { my_pthread_yield(); }
+        sem_post(&sem);
+    }
+    for (i = 0; i < 3; i++) { pthread_join(threads[i], NULL); }
+
+    int value;
+    sem_getvalue(&sem, &value);
+    check("semaphore handoff", handedOff);
+    check("semaphore order", semOrder[0] == 0 && semOrder[1] == 1 && semOrder[2] == 2);
+    check("semaphore destroy", value == 0 && sem_destroy(&sem) == 0);
+}
+
+// Every thread sees the others reach a barrier each round,
+// and one of them gets PTHREAD_BARRIER_SERIAL_THREAD
+#define NUM_BARRIER_THREADS 4
+#define NUM_BARRIER_ROUNDS 50
+pthread_barrier_t barrier;
+int barrierRounds[NUM_BARRIER_THREADS];
+int barrierBroken = 0;
+
+void * barrierWorker(void * id) {
+    long serials = 0;
+    int round, i;
+    for (round = 0; round < NUM_BARRIER_ROUNDS; round++) {
+        barrierRounds[(long) id] = round;
+        // Yield now and then so threads arrive in different orders
+        if ((round + (long) id) % 3 == 0) { my_pthread_yield(); }
+        if (pthread_barrier_wait(&barrier) == PTHREAD_BARRIER_SERIAL_THREAD) { serials++; }
+        for (i = 0; i < NUM_BARRIER_THREADS; i++) {
+            if (barrierRounds[i] != round) { barrierBroken = 1; }
+        }
+        pthread_barrier_wait(&barrier);
+    }
+    return (void *) serials;
+}
+
+void testBarrier() {
+    pthread_t threads[NUM_BARRIER_THREADS];
+    long i, serials = 0;
+    void * ret;
+    check("barrier count 0", pthread_barrier_init(&barrier, NULL, 0) == EINVAL);
+    pthread_barrier_init(&barrier, NULL, NUM_BARRIER_THREADS);
+    for (i = 0; i < NUM_BARRIER_THREADS; i++) { pthread_create(&threads[i], NULL, barrierWorker, (void *) i); }
+    for (i = 0; i < NUM_BARRIER_THREADS; i++) {
+        pthread_join(threads[i], &ret);
+        serials += (long) ret;
+    }
+    check("barrier rounds", !barrierBroken);
+    check("barrier serial thread", serials == NUM_BARRIER_ROUNDS);
+    check("barrier destroy", pthread_barrier_destroy(&barrier) == 0);
+}
+
+// A signal wakes one thread waiting on a condition variable and a
+// broadcast wakes the rest
+pthread_mutex_t condMutex;
+pthread_cond_t cond;
+int condReady = 0;
+int numCondWaiters = 0;
+int numCondWoken = 0;
+
+void * condWaiter(void * arg) {
+    pthread_mutex_lock(&condMutex);
+    numCondWaiters++;
+    while (!condReady) { pthread_cond_wait(&cond, &condMutex); }
+    numCondWoken++;
+    pthread_mutex_unlock(&condMutex);
+    return NULL;
+}
+
+void testCondition() {
+    pthread_t threads[3];
+    int i;
+    pthread_mutex_init(&condMutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    for (i = 0; i < 3; i++) { pthread_create(&threads[i], NULL, condWaiter, NULL); }
+    while (numCondWaiters < 3) { my_pthread_yield(); }
+    check("condition destroy with waiters", pthread_cond_destroy(&cond) == EBUSY);
+
+    pthread_mutex_lock(&condMutex);
+    condReady = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&condMutex);
+    for (i = 0; i < 10; i++) { my_pthread_yield(); }
+    check("condition signal", numCondWoken == 1);
+
+    pthread_mutex_lock(&condMutex);
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&condMutex);
+    for (i = 0; i < 3; i++) { pthread_join(threads[i], NULL); }
+    check("condition broadcast", numCondWoken == 3);
+    check("condition destroy", pthread_cond_destroy(&cond) == 0);
+}
+
+// Once a writer waits for a reader-writer lock, new readers wait
+// behind it even though only readers hold the lock
+pthread_rwlock_t rwlock;
+int rwlockOrder[2];
+int numRwlockHolders = 0;
+int numRwlockWaiters = 0;
+
+void * rwlockWriter(void * arg) {
+    numRwlockWaiters++;
+    pthread_rwlock_wrlock(&rwlock);
+    rwlockOrder[numRwlockHolders++] = 'w';
+    pthread_rwlock_unlock(&rwlock);
+    return NULL;
+}
+
+void * rwlockReader(void * arg) {
+    numRwlockWaiters++;
+    pthread_rwlock_rdlock(&rwlock);
+    rwlockOrder[numRwlockHolders++] = 'r';
+    pthread_rwlock_unlock(&rwlock);
+    return NULL;
+}
+
+void testRwlock() {
+    pthread_t writer, reader;
+    pthread_rwlock_init(&rwlock, NULL);
+    check("rwlock unlock unheld", pthread_rwlock_unlock(&rwlock) == EPERM);
+    pthread_rwlock_rdlock(&rwlock);
+    check("rwlock shared read", pthread_rwlock_tryrdlock(&rwlock) == 0);
+    pthread_rwlock_unlock(&rwlock);
+    check("rwlock write while read", pthread_rwlock_trywrlock(&rwlock) == EBUSY);
+
+    pthread_create(&writer, NULL, rwlockWriter, NULL);
+    while (numRwlockWaiters < 1) { my_pthread_yield(); }
+    check("rwlock writer preferred", pthread_rwlock_tryrdlock(&rwlock) == EBUSY);
+    pthread_create(&reader, NULL, rwlockReader, NULL);
+    while (numRwlockWaiters < 2) { my_pthread_yield(); }
+    check("rwlock destroy while held", pthread_rwlock_destroy(&rwlock) == EBUSY);
+    pthread_rwlock_unlock(&rwlock);
+    pthread_join(writer, NULL);
+    pthread_join(reader, NULL);
+    check("rwlock writer first", numRwlockHolders == 2 && rwlockOrder[0] == 'w' && rwlockOrder[1] == 'r');
+    check("rwlock counters", rwlock.writeContentions == 1 && rwlock.readContentions == 1);
+    check("rwlock destroy", pthread_rwlock_destroy(&rwlock) == 0);
+}
+
+// Mutexes count the times they were locked and found locked
+pthread_mutex_t mutex;
+
+void * mutexLocker(void * arg) {
+    pthread_mutex_lock(&mutex);
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+void testMutex() {
+    pthread_t thread;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_mutex_lock(&mutex);
+    pthread_create(&thread, NULL, mutexLocker, NULL);
+    while (mutex.waits < 1) { my_pthread_yield(); }
+    check("mutex destroy while locked", pthread_mutex_destroy(&mutex) == EBUSY);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+    check("mutex counters", mutex.acquisitions == 2 && mutex.contentions == 1);
+    check("mutex destroy", pthread_mutex_destroy(&mutex) == 0);
+}
+
+// Nice values stay in range and the latency percentiles the
+// scheduler reports never exceed the largest latency it saw
+void * spinner(void * loops) {
+    volatile long i;
+    for (i = 0; i < (long) loops; i++);
+    return NULL;
+}
+
+void testScheduler() {
+    pthread_t threads[3];
+    int i;
+    for (i = 0; i < 3; i++) { pthread_create(&threads[i], NULL, spinner, (void *) 20000000L); }
+    check("nice out of range", my_pthread_setnice(threads[0], 20) == EINVAL && my_pthread_setnice(threads[0], -21) == EINVAL);
+    check("nice", my_pthread_setnice(threads[0], 5) == 0 && my_pthread_getnice(threads[0]) == 5);
+    for (i = 0; i < 3; i++) { pthread_join(threads[i], NULL); }
+
+    struct schedulerStats stats;
+    getSchedulerStats(&stats);
+    check("latency percentiles", stats.switches > 0 && stats.p50Latency <= stats.p99Latency && stats.p99Latency <= stats.maxLatency);
+}
+
+// Deadlines pass while a thread sleeps, waits for a mutex or joins,
+// and several threads can join the same thread
+#define TIMEOUT 20000
+int joinRelease = 0;
+int numJoinersStarted = 0;
+pthread_mutex_t timedMutex;
+
+// Returns the time of day <microseconds> from now
+struct timespec getTimeFromNow(long microseconds) {
+    struct timeval now;
+    struct timespec time;
+    gettimeofday(&now, NULL);
+    microseconds += now.tv_usec;
+    time.tv_sec = now.tv_sec + (microseconds / 1000000);
+    time.tv_nsec = (microseconds % 1000000) * 1000;
+    return time;
+}
+
+// Returns the microseconds from <start> to now
+long getElapsed(struct timeval * start) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return ((now.tv_sec - start->tv_sec) * 1000000) + (now.tv_usec - start->tv_usec);
+}
+
+void * joinTarget(void * arg) {
+    while (!joinRelease) { my_pthread_yield(); }
+    return (void *) 42L;
+}
+
+void * joiner(void * target) {
+    void * ret = NULL;
+    numJoinersStarted++;
+    if (pthread_join(target, &ret) != 0) { return NULL; }
+    return ret;
+}
+
+void * timedLocker(void * arg) {
+    struct timespec deadline = getTimeFromNow(TIMEOUT);
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    int ret = pthread_mutex_timedlock(&timedMutex, &deadline);
+    return (void *) (long) (ret == ETIMEDOUT && getElapsed(&start) >= TIMEOUT);
+}
+
+void testTimers() {
+    struct timeval start;
+    struct timespec deadline;
+    pthread_t target, joiners[2], locker;
+    void * ret, * rets[2];
+    int i;
+
+    gettimeofday(&start, NULL);
+    my_pthread_sleep(TIMEOUT);
+    check("sleep", getElapsed(&start) >= TIMEOUT);
+
+    pthread_mutex_init(&timedMutex, NULL);
+    pthread_mutex_lock(&timedMutex);
+    pthread_create(&locker, NULL, timedLocker, NULL);
+    pthread_join(locker, &ret);
+    check("timedlock timeout", ret != NULL);
+    deadline.tv_sec = 0;
+    deadline.tv_nsec = 1000000000;
+    check("timedlock invalid time", pthread_mutex_timedlock(&timedMutex, &deadline) == EINVAL);
+    pthread_mutex_unlock(&timedMutex);
+    deadline = getTimeFromNow(TIMEOUT);
+    check("timedlock", pthread_mutex_timedlock(&timedMutex, &deadline) == 0);
+    pthread_mutex_unlock(&timedMutex);
+
+    // The target is joined by two threads while this thread's
+    // timed join gives up on it
+    pthread_create(&target, NULL, joinTarget, NULL);
+    for (i = 0; i < 2; i++) { pthread_create(&joiners[i], NULL, joiner, target); }
+    while (numJoinersStarted < 2) { my_pthread_yield(); }
+    gettimeofday(&start, NULL);
+    deadline = getTimeFromNow(TIMEOUT);
+    check("timedjoin timeout", pthread_timedjoin_np(target, &ret, &deadline) == ETIMEDOUT && getElapsed(&start) >= TIMEOUT);
+    joinRelease = 1;
+    for (i = 0; i < 2; i++) { pthread_join(joiners[i], &rets[i]); }
+    check("several joiners", rets[0] == (void *) 42L && rets[1] == (void *) 42L);
+
+    // A thread left by a timed out join can be joined later
+    joinRelease = 0;
+    pthread_create(&target, NULL, joinTarget, NULL);
+    deadline = getTimeFromNow(TIMEOUT);
+    check("timedjoin timeout alone", pthread_timedjoin_np(target, &ret, &deadline) == ETIMEDOUT);
+    joinRelease = 1;
+    deadline = getTimeFromNow(TIMEOUT * 50);
+    check("timedjoin", pthread_timedjoin_np(target, &ret, &deadline) == 0 && ret == (void *) 42L);
+}
+
+// Threads wait on pipes and loopback sockets without stopping the
+// others, and the descriptors keep the flags they had
+#define IO_BYTES (200 * 1024)
+int ioPipe[2];
+int listener;
+
+// Returns 1 if <fd> isn't non-blocking
+int isBlocking(int fd) {
+    return !(fcntl(fd, F_GETFL) & O_NONBLOCK);
+}
+
+// Writes IO_BYTES numbered bytes into the pipe, more than it holds
+void * pipeWriter(void * arg) {
+    char * buf = malloc(IO_BYTES);
+    size_t i, written = 0;
+    for (i = 0; i < IO_BYTES; i++) { buf[i] = i % 251; }
+    while (written < IO_BYTES) {
+        ssize_t ret = my_write(ioPipe[1], buf + written, IO_BYTES - written);
+        if (ret <= 0) { break; }
+        written += ret;
+    }
+    free(buf);
+    return (void *) written;
+}
+
+// Echoes one message back to the first client
+void * echoServer(void * arg) {
+    char buf[16];
+    int client = my_accept(listener, NULL, NULL);
+    if (client < 0) { return NULL; }
+    ssize_t ret = my_read(client, buf, sizeof(buf));
+    if (ret > 0) { my_write(client, buf, ret); }
+    close(client);
+    return (void *) ret;
+}
+
+void testIo() {
+    pthread_t thread;
+    void * ret;
+    size_t i, numRead = 0;
+    int intact = 1;
+
+    pipe(ioPipe);
+    pthread_create(&thread, NULL, pipeWriter, NULL);
+    char * buf = malloc(IO_BYTES);
+    while (numRead < IO_BYTES) {
+        ssize_t got = my_read(ioPipe[0], buf + numRead, IO_BYTES - numRead);
+        if (got <= 0) { break; }
+        numRead += got;
+    }
+    pthread_join(thread, &ret);
+    for (i = 0; i < numRead; i++) {
+        if (buf[i] != (char) (i % 251)) { intact = 0; }
+    }
+    free(buf);
+    check("pipe transfer", numRead == IO_BYTES && (size_t) ret == IO_BYTES && intact);
+    check("pipe flags", isBlocking(ioPipe[0]) && isBlocking(ioPipe[1]));
+    close(ioPipe[1]);
+    char byte;
+    check("pipe end of file", my_read(ioPipe[0], &byte, 1) == 0);
+    close(ioPipe[0]);
+
+    // Echo through a loopback connection
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    bind(listener, (struct sockaddr *) &address, sizeof(address));
+    listen(listener, 1);
+    getsockname(listener, (struct sockaddr *) &address, &length);
+    pthread_create(&thread, NULL, echoServer, NULL);
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    char reply[16] = "";
+    int connected = my_connect(client, (struct sockaddr *) &address, sizeof(address)) == 0;
+    if (connected && my_write(client, "hello", 5) == 5) { my_read(client, reply, sizeof(reply)); }
+    pthread_join(thread, &ret);
+    check("loopback echo", connected && (long) ret == 5 && memcmp(reply, "hello", 5) == 0);
+    check("socket flags", isBlocking(listener) && isBlocking(client));
+    close(client);
+
+    // Nothing listens on the port once the listener is closed
+    close(listener);
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    check("connect refused", my_connect(client, (struct sockaddr *) &address, sizeof(address)) == -1 && errno == ECONNREFUSED);
+    close(client);
+}
+
 int main() {
     char * rand = malloc(200);
     sprintf(rand, "thanks dog");
@@ -40,5 +745,24 @@ int main() {
     pthread_join(t2, &ret);
 	some = ret;
 	printf("%s\n", some);
-    return 0;
+
+    testFreeLists();
+    testSwap();
+    testSwapCounters();
+    testCompression();
+    testExitReclaim();
+    testSharedArenas();
+    testLargeRuns();
+    testReallocation();
+    testMagazines();
+    testMemoryStats();
+    testSemaphore();
+    testBarrier();
+    testCondition();
+    testRwlock();
+    testMutex();
+    testScheduler();
+    testTimers();
+    testIo();
+    return failed;
 }
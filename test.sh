@@ -1,4 +1,9 @@
 #! /bin/bash
 
 gcc -g -Wall -o test test.c mylib.c my_pthread.c &&
-./test
+./test &&
+MYLIB_REMAP_PAGE_SIZE=0 ./test &&
+MYLIB_SWAP_MODE=mmap ./test &&
+MYLIB_FAULT_MODE=userfaultfd ./test &&
+MYLIB_HEAP_PROFILE=0 ./test 2> /dev/null &&
+MY_PTHREAD_SCHEDULER=fair ./test